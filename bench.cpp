@@ -0,0 +1,495 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "bsp.hpp"
+#include "input.hpp"
+#include "packet.hpp"
+#include "index.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+// Coordenadas geradas ficam em [-BENCH_EXTENT, BENCH_EXTENT]: abaixo de 2^15, o teste em pacote é exato
+const int BENCH_EXTENT = 10000;
+
+// ======================================================================================================================= //
+
+// Tipos de malha sintética
+enum class MeshKind { SOUP, TERRAIN, SPHERE, COPLANAR, SPANNING };
+
+static bool parseMeshKind(const string& name, MeshKind& kind) {
+  if (name == "soup") kind = MeshKind::SOUP;
+  else if (name == "terrain") kind = MeshKind::TERRAIN;
+  else if (name == "sphere") kind = MeshKind::SPHERE;
+  else if (name == "coplanar") kind = MeshKind::COPLANAR;
+  else if (name == "spanning") kind = MeshKind::SPANNING;
+  else return false;
+  return true;
+}
+
+static const char* meshKindName(MeshKind kind) {
+  switch (kind) {
+    case MeshKind::SOUP: return "soup";
+    case MeshKind::TERRAIN: return "terrain";
+    case MeshKind::SPHERE: return "sphere";
+    case MeshKind::COPLANAR: return "coplanar";
+    case MeshKind::SPANNING: return "spanning";
+  }
+  return "?";
+}
+
+// Conjuntos de segmentos (--rays=...)
+enum class RayKind { RANDOM, SCANLINE };
+
+static bool parseRayKind(const string& name, RayKind& kind) {
+  if (name == "random") kind = RayKind::RANDOM;
+  else if (name == "scanline") kind = RayKind::SCANLINE;
+  else return false;
+  return true;
+}
+
+static const char* rayKindName(RayKind kind) {
+  return kind == RayKind::RANDOM ? "random" : "scanline";
+}
+
+// Modos de percurso comparados (--traversal=...)
+enum class Traversal { PLAIN, CLIP, ANY_HIT, COHERENT };
+
+static bool parseTraversal(const string& name, Traversal& traversal) {
+  if (name == "plain") traversal = Traversal::PLAIN;
+  else if (name == "clip") traversal = Traversal::CLIP;
+  else if (name == "anyhit") traversal = Traversal::ANY_HIT;
+  else if (name == "coherent") traversal = Traversal::COHERENT;
+  else return false;
+  return true;
+}
+
+static const char* traversalName(Traversal traversal) {
+  switch (traversal) {
+    case Traversal::PLAIN: return "plain";
+    case Traversal::CLIP: return "clip";
+    case Traversal::ANY_HIT: return "anyhit";
+    case Traversal::COHERENT: return "coherent";
+  }
+  return "?";
+}
+
+// ======================================================================================================================= //
+
+// Acrescenta um triângulo com vértices novos
+static void addTriangle(BSPData& data, const Point3D& a, const Point3D& b, const Point3D& c) {
+  int base = (int)data.points.size();
+  data.points.push_back(a);
+  data.points.push_back(b);
+  data.points.push_back(c);
+  data.triangles.emplace_back(base + 1, base + 2, base + 3);
+}
+
+// Triângulos pequenos espalhados no cubo, com tamanho proporcional ao espaçamento médio entre eles
+static void generateSoup(BSPData& data, int t, mt19937_64& rng) {
+  int size = max(2, (int)(2 * BENCH_EXTENT / cbrt((double)max(t, 1))));
+  uniform_int_distribution<int> coord(-BENCH_EXTENT + size, BENCH_EXTENT - size);
+  uniform_int_distribution<int> offset(-size, size);
+  for (int i = 0; i < t; ++i) {
+    Point3D p(coord(rng), coord(rng), coord(rng));
+    addTriangle(data, p,
+                Point3D(p.x + offset(rng), p.y + offset(rng), p.z + offset(rng)),
+                Point3D(p.x + offset(rng), p.y + offset(rng), p.z + offset(rng)));
+  }
+}
+
+// Terreno: grade k x k com alturas suaves e dois triângulos por célula, até completar t triângulos
+static void generateTerrain(BSPData& data, int t, mt19937_64& rng) {
+  int k = (int)ceil(sqrt(t / 2.0)) + 1;
+  uniform_real_distribution<double> phase(0, 2 * M_PI);
+  double p1 = phase(rng), p2 = phase(rng);
+  for (int i = 0; i < k; ++i) {
+    for (int j = 0; j < k; ++j) {
+      double u = (double)i / (k - 1), v = (double)j / (k - 1);
+      double h = 0.3 * sin(6 * u + p1) * cos(5 * v + p2) + 0.1 * sin(23 * u * v + p2);
+      data.points.emplace_back((int)lround((2 * u - 1) * BENCH_EXTENT), (int)lround((2 * v - 1) * BENCH_EXTENT), (int)lround(h * BENCH_EXTENT));
+    }
+  }
+  for (int i = 0; i + 1 < k && (int)data.triangles.size() < t; ++i) {
+    for (int j = 0; j + 1 < k && (int)data.triangles.size() < t; ++j) {
+      int a = i * k + j + 1, b = a + 1, c = a + k, d = c + 1;
+      data.triangles.emplace_back(a, b, d);
+      if ((int)data.triangles.size() < t) data.triangles.emplace_back(a, d, c);
+    }
+  }
+}
+
+// Esfera fechada em latitude/longitude, com cerca de t triângulos; os polos são vértices únicos
+static void generateSphere(BSPData& data, int t, mt19937_64&) {
+  int slices = max(3, (int)ceil(sqrt(max(t, 1) / 2.0)));
+  int rings = max(2, (t + 2 * slices - 1) / (2 * slices) + 1);
+  double r = BENCH_EXTENT;
+  data.points.emplace_back(0, 0, (int)r);
+  for (int i = 1; i < rings; ++i) {
+    double theta = M_PI * i / rings;
+    for (int j = 0; j < slices; ++j) {
+      double phi = 2 * M_PI * j / slices;
+      data.points.emplace_back((int)lround(r * sin(theta) * cos(phi)), (int)lround(r * sin(theta) * sin(phi)), (int)lround(r * cos(theta)));
+    }
+  }
+  data.points.emplace_back(0, 0, -(int)r);
+
+  int north = 1, south = (int)data.points.size();
+  auto ring = [&](int i, int j) { return 2 + (i - 1) * slices + (j % slices); };
+  for (int j = 0; j < slices; ++j) data.triangles.emplace_back(north, ring(1, j), ring(1, j + 1));
+  for (int i = 1; i + 1 < rings; ++i) {
+    for (int j = 0; j < slices; ++j) {
+      data.triangles.emplace_back(ring(i, j), ring(i + 1, j), ring(i + 1, j + 1));
+      data.triangles.emplace_back(ring(i, j), ring(i + 1, j + 1), ring(i, j + 1));
+    }
+  }
+  for (int j = 0; j < slices; ++j) data.triangles.emplace_back(south, ring(rings - 1, j + 1), ring(rings - 1, j));
+}
+
+// Pior caso de classificação: todos os triângulos no plano z = 0
+static void generateCoplanar(BSPData& data, int t, mt19937_64& rng) {
+  int size = max(2, (int)(2 * BENCH_EXTENT / sqrt((double)max(t, 1))));
+  uniform_int_distribution<int> coord(-BENCH_EXTENT + size, BENCH_EXTENT - size);
+  uniform_int_distribution<int> offset(-size, size);
+  for (int i = 0; i < t; ++i) {
+    Point3D p(coord(rng), coord(rng), 0);
+    addTriangle(data, p, Point3D(p.x + offset(rng), p.y + offset(rng), 0), Point3D(p.x + offset(rng), p.y + offset(rng), 0));
+  }
+}
+
+// Pior caso de duplicação: triângulos em leque em torno do eixo z, cada um em um plano que contém o eixo e
+// atravessa todos os outros. Com muitos triângulos, ângulos vizinhos arredondam para planos quase iguais.
+static void generateSpanning(BSPData& data, int t, mt19937_64& rng) {
+  uniform_int_distribution<int> jitter(-BENCH_EXTENT / 100, BENCH_EXTENT / 100);
+  for (int i = 0; i < t; ++i) {
+    double angle = M_PI * (i + 0.5) / t;
+    int x = (int)lround(BENCH_EXTENT * cos(angle)), y = (int)lround(BENCH_EXTENT * sin(angle));
+    addTriangle(data, Point3D(x, y, -BENCH_EXTENT + jitter(rng)), Point3D(-x, -y, -BENCH_EXTENT + jitter(rng)), Point3D(0, 0, BENCH_EXTENT));
+  }
+}
+
+// Segmentos com extremos sorteados no cubo
+static void generateRandomSegments(BSPData& data, int l, mt19937_64& rng) {
+  uniform_int_distribution<int> coord(-BENCH_EXTENT, BENCH_EXTENT);
+  data.segments.reserve(l);
+  for (int i = 0; i < l; ++i) data.segments.emplace_back(coord(rng), coord(rng), coord(rng), coord(rng), coord(rng), coord(rng));
+}
+
+// Varredura: segmentos quase paralelos que atravessam o cubo ao longo de x, em linhas de uma grade em (y, z), com
+// uma pequena inclinação sorteada. A ordem de saída é embaralhada, como quando as linhas chegam de várias fontes.
+static void generateScanlineSegments(BSPData& data, int l, mt19937_64& rng) {
+  int side = max(1, (int)ceil(sqrt((double)l)));
+  int step = 2 * BENCH_EXTENT / side;
+  uniform_int_distribution<int> tilt(-step / 4, step / 4);
+  size_t first = data.segments.size();
+  for (int i = 0; i < l; ++i) {
+    int y = -BENCH_EXTENT + step / 2 + (i / side) * step, z = -BENCH_EXTENT + step / 2 + (i % side) * step;
+    data.segments.emplace_back(-BENCH_EXTENT, y, z, BENCH_EXTENT, y + tilt(rng), z + tilt(rng));
+  }
+  shuffle(data.segments.begin() + first, data.segments.end(), rng);
+}
+
+static BSPData generate(MeshKind kind, RayKind rays, int t, int l, unsigned long long seed) {
+  BSPData data;
+  mt19937_64 rng(seed);
+  switch (kind) {
+    case MeshKind::SOUP: generateSoup(data, t, rng); break;
+    case MeshKind::TERRAIN: generateTerrain(data, t, rng); break;
+    case MeshKind::SPHERE: generateSphere(data, t, rng); break;
+    case MeshKind::COPLANAR: generateCoplanar(data, t, rng); break;
+    case MeshKind::SPANNING: generateSpanning(data, t, rng); break;
+  }
+  if (rays == RayKind::RANDOM) generateRandomSegments(data, l, rng);
+  else generateScanlineSegments(data, l, rng);
+  return data;
+}
+
+// ======================================================================================================================= //
+
+// Grava a entrada no formato texto em um arquivo temporário, para medir a leitura pelo mesmo caminho do programa
+static FILE* writeTextInput(const BSPData& data) {
+  FILE* file = tmpfile();
+  if (!file) throw runtime_error("não foi possível criar arquivo temporário");
+  fprintf(file, "%zu %zu %zu\n", data.points.size(), data.triangles.size(), data.segments.size());
+  for (const Point3D& p : data.points) fprintf(file, "%d %d %d\n", p.x, p.y, p.z);
+  for (const Triangle& tri : data.triangles) fprintf(file, "%d %d %d\n", tri.a, tri.b, tri.c);
+  for (const Segment& s : data.segments) fprintf(file, "%d %d %d %d %d %d\n", s.p1.x, s.p1.y, s.p1.z, s.p2.x, s.p2.y, s.p2.z);
+  fflush(file);
+  return file;
+}
+
+// Uma linha do resultado: a configuração e os tempos (menor de cada fase entre as repetições), em milissegundos
+struct BenchRow {
+  string mesh, rays;
+  size_t triangles = 0, segments = 0;
+  string index, split, simd, traversal;
+  bool split_spanning = false;
+  int leaf_size = 0, min_triangles = 1, threads = 1;
+  double parse_ms = 0, build_ms = 0, flatten_ms = 0, query_ms = 0;
+  TreeStats stats;
+  size_t hits = 0;
+};
+
+template <typename F>
+static double timeMs(F&& f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Lê, constrói, lineariza e consulta repeat vezes, guardando o menor tempo de cada fase. Grade e BVH não têm
+// linearização: a construção é cache + SpatialIndex::build e as consultas passam pela interface.
+static void runBench(const BSPData& generated, IndexKind index_kind, BuildOptions options, QueryOptions query_options, int repeat, BenchRow& row) {
+  FILE* file = writeTextInput(generated);
+  row.parse_ms = row.build_ms = row.flatten_ms = row.query_ms = INFINITY;
+
+  for (int r = 0; r < repeat; ++r) {
+    BSPData data;
+    lseek(fileno(file), 0, SEEK_SET);
+    row.parse_ms = min(row.parse_ms, timeMs([&] { data = readInput(fileno(file)); }));
+
+    if (index_kind != IndexKind::BSP) {
+      TriangleCache cache;
+      unique_ptr<SpatialIndex> index = makeSpatialIndex(index_kind, options, query_options.simd);
+      row.build_ms = min(row.build_ms, timeMs([&] {
+        cache = buildTriangleCache(data.triangles, data.points);
+        index->build(cache);
+      }));
+      row.flatten_ms = 0;
+
+      QueryResults results;
+      row.query_ms = min(row.query_ms, timeMs([&] {
+        QuerySession session(cache, *index, query_options);
+        session.run(data.segments, results);
+      }));
+      row.hits = results.ids.size();
+      continue;
+    }
+
+    vector<int> all_indices(data.triangles.size());
+    for (int i = 0; i < (int)data.triangles.size(); ++i) all_indices[i] = i;
+    TriangleCache cache;
+    BSPTree tree;
+    row.build_ms = min(row.build_ms, timeMs([&] {
+      cache = buildTriangleCache(data.triangles, data.points);
+      tree = buildBSP(cache, all_indices, options);
+    }));
+    row.stats = computeTreeStats(tree.get());
+
+    FlatBSP flat;
+    row.flatten_ms = min(row.flatten_ms, timeMs([&] { flat = flattenBSP(tree.get()); }));
+    tree.reset();
+
+    QueryResults results;
+    row.query_ms = min(row.query_ms, timeMs([&] { results = processSegments(data, cache, flat, query_options); }));
+    row.hits = results.ids.size();
+  }
+  fclose(file);
+}
+
+// ======================================================================================================================= //
+
+static void printCsvHeader() {
+  printf("mesh,rays,triangles,segments,index,split,split_spanning,leaf_size,min_triangles,simd,traversal,threads,"
+         "parse_ms,build_ms,flatten_ms,query_ms,nodes,depth,leaves,hits\n");
+}
+
+static void printCsv(const BenchRow& row) {
+  printf("%s,%s,%zu,%zu,%s,%s,%d,%d,%d,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%d,%d,%d,%zu\n",
+         row.mesh.c_str(), row.rays.c_str(), row.triangles, row.segments, row.index.c_str(), row.split.c_str(), row.split_spanning, row.leaf_size,
+         row.min_triangles, row.simd.c_str(), row.traversal.c_str(), row.threads, row.parse_ms, row.build_ms,
+         row.flatten_ms, row.query_ms, row.stats.nodes, row.stats.depth, row.stats.leaves, row.hits);
+}
+
+static void printJson(const BenchRow& row, bool first) {
+  printf("%s\n  {\"mesh\": \"%s\", \"rays\": \"%s\", \"triangles\": %zu, \"segments\": %zu, \"index\": \"%s\", \"split\": \"%s\", \"split_spanning\": %s, "
+         "\"leaf_size\": %d, \"min_triangles\": %d, \"simd\": \"%s\", \"traversal\": \"%s\", \"threads\": %d, "
+         "\"parse_ms\": %.3f, \"build_ms\": %.3f, \"flatten_ms\": %.3f, \"query_ms\": %.3f, "
+         "\"nodes\": %d, \"depth\": %d, \"leaves\": %d, \"hits\": %zu}",
+         first ? "" : ",", row.mesh.c_str(), row.rays.c_str(), row.triangles, row.segments, row.index.c_str(), row.split.c_str(),
+         row.split_spanning ? "true" : "false", row.leaf_size, row.min_triangles, row.simd.c_str(),
+         row.traversal.c_str(), row.threads, row.parse_ms, row.build_ms, row.flatten_ms, row.query_ms,
+         row.stats.nodes, row.stats.depth, row.stats.leaves, row.hits);
+}
+
+// Separa uma lista "a,b,c"
+static vector<string> splitList(const string& list) {
+  vector<string> items;
+  stringstream stream(list);
+  string item;
+  while (getline(stream, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+static void usage(const char* program) {
+  cerr << "Uso: " << program << " [--mesh=soup,terrain,sphere,coplanar,spanning] [--rays=random,scanline]\n"
+       << "       [--triangles=T1,T2,...] [--segments=L1,L2,...] [--index=bsp,grid,bvh] [--split=first,random,balanced,sah]\n"
+       << "       [--simd=auto,scalar,sse4,avx2] [--traversal=plain,clip,anyhit,coherent] [--split-spanning] [--leaf-size=N] [--min-triangles=N]\n"
+       << "       [--threads=N] [--repeat=N] [--seed=N] [--format=csv|json]\n";
+}
+
+int main(int argc, char *argv[]) {
+  vector<MeshKind> meshes = {MeshKind::SOUP, MeshKind::TERRAIN, MeshKind::SPHERE, MeshKind::COPLANAR, MeshKind::SPANNING};
+  vector<RayKind> ray_kinds = {RayKind::RANDOM};
+  vector<int> triangle_counts = {1000, 10000};
+  vector<int> segment_counts = {1000, 10000};
+  vector<IndexKind> index_kinds = {IndexKind::BSP};
+  vector<SplitStrategy> strategies = {SplitStrategy::FIRST};
+  vector<SimdLevel> simd_levels = {SimdLevel::AUTO};
+  vector<Traversal> traversals = {Traversal::PLAIN};
+  BuildOptions options;
+  options.min_triangles = 2; // Evita a árvore quadrática da malha "spanning"; 1 reproduz o ./bsp padrão
+  int threads = 1;
+  int repeat = 3;
+  unsigned long long seed = 1;
+  bool json = false;
+
+  // Listas separadas por vírgula definem a varredura; as demais opções valem para todas as execuções
+  try {
+    for (int i = 1; i < argc; ++i) {
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+      if (arg.rfind("--mesh=", 0) == 0) {
+        meshes.clear();
+        for (const string& name : splitList(value)) {
+          MeshKind kind;
+          if (!parseMeshKind(name, kind)) throw invalid_argument("malha inválida: " + name);
+          meshes.push_back(kind);
+        }
+      } else if (arg.rfind("--rays=", 0) == 0) {
+        ray_kinds.clear();
+        for (const string& name : splitList(value)) {
+          RayKind kind;
+          if (!parseRayKind(name, kind)) throw invalid_argument("conjunto de segmentos inválido: " + name);
+          ray_kinds.push_back(kind);
+        }
+      } else if (arg.rfind("--triangles=", 0) == 0) {
+        triangle_counts.clear();
+        for (const string& n : splitList(value)) triangle_counts.push_back(stoi(n));
+      } else if (arg.rfind("--segments=", 0) == 0) {
+        segment_counts.clear();
+        for (const string& n : splitList(value)) segment_counts.push_back(stoi(n));
+      } else if (arg.rfind("--index=", 0) == 0) {
+        index_kinds.clear();
+        for (const string& name : splitList(value)) {
+          IndexKind kind;
+          if (!parseIndexKind(name, kind)) throw invalid_argument("estrutura de aceleração inválida: " + name);
+          index_kinds.push_back(kind);
+        }
+      } else if (arg.rfind("--split=", 0) == 0) {
+        strategies.clear();
+        for (const string& name : splitList(value)) {
+          SplitStrategy strategy;
+          if (!parseSplitStrategy(name, strategy)) throw invalid_argument("estratégia de divisão inválida: " + name);
+          strategies.push_back(strategy);
+        }
+      } else if (arg.rfind("--simd=", 0) == 0) {
+        simd_levels.clear();
+        for (const string& name : splitList(value)) {
+          SimdLevel level;
+          if (!parseSimdLevel(name, level)) throw invalid_argument("conjunto de instruções inválido: " + name);
+          simd_levels.push_back(level);
+        }
+      } else if (arg.rfind("--traversal=", 0) == 0) {
+        traversals.clear();
+        for (const string& name : splitList(value)) {
+          Traversal traversal;
+          if (!parseTraversal(name, traversal)) throw invalid_argument("percurso inválido: " + name);
+          traversals.push_back(traversal);
+        }
+      } else if (arg == "--split-spanning") {
+        options.split_spanning = true;
+      } else if (arg.rfind("--leaf-size=", 0) == 0) {
+        options.leaf_size = stoi(value);
+      } else if (arg.rfind("--min-triangles=", 0) == 0) {
+        options.min_triangles = stoi(value);
+      } else if (arg.rfind("--threads=", 0) == 0) {
+        threads = stoi(value);
+      } else if (arg.rfind("--repeat=", 0) == 0) {
+        repeat = max(stoi(value), 1);
+      } else if (arg.rfind("--seed=", 0) == 0) {
+        seed = stoull(value);
+      } else if (arg == "--format=csv" || arg == "--format=json") {
+        json = value == "json";
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+  } catch (const logic_error& e) {
+    cerr << "Erro: " << e.what() << "\n";
+    usage(argv[0]);
+    return 1;
+  }
+
+  options.threads = threads;
+  if (json) printf("[");
+  else printCsvHeader();
+
+  bool first = true;
+  for (MeshKind mesh : meshes) {
+    for (RayKind rays : ray_kinds) {
+      for (int t : triangle_counts) {
+        for (int l : segment_counts) {
+          BSPData data = generate(mesh, rays, t, l, seed);
+          for (IndexKind index_kind : index_kinds) {
+            // As estratégias de divisão só mudam a BSP; as outras estruturas rodam uma vez
+            bool bsp = index_kind == IndexKind::BSP;
+            for (size_t s = 0; s < (bsp ? strategies.size() : min(strategies.size(), (size_t)1)); ++s) {
+              for (SimdLevel simd : simd_levels) {
+                for (Traversal traversal : traversals) {
+                  options.strategy = strategies[s];
+                  QueryOptions query_options;
+                  query_options.threads = threads;
+                  query_options.simd = simd;
+                  query_options.clip = traversal == Traversal::CLIP || traversal == Traversal::ANY_HIT;
+                  query_options.any_hit = traversal == Traversal::ANY_HIT;
+                  query_options.coherent = traversal == Traversal::COHERENT;
+
+                  BenchRow row;
+                  row.mesh = meshKindName(mesh);
+                  row.rays = rayKindName(rays);
+                  row.triangles = data.triangles.size();
+                  row.segments = data.segments.size();
+                  row.index = indexKindName(index_kind);
+                  row.split = bsp ? splitStrategyName(strategies[s]) : "-";
+                  row.simd = simdLevelName(resolveSimdLevel(simd));
+                  row.traversal = traversalName(traversal);
+                  row.split_spanning = options.split_spanning;
+                  row.leaf_size = options.leaf_size;
+                  row.min_triangles = options.min_triangles;
+                  row.threads = threads;
+                  runBench(data, index_kind, options, query_options, repeat, row);
+
+                  if (json) printJson(row, first);
+                  else printCsv(row);
+                  fflush(stdout);
+                  first = false;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  if (json) printf("\n]\n");
+  return 0;
+}
@@ -0,0 +1,282 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "binary.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char BINARY_MAGIC[8] = {'B', 'S', 'P', 'M', 'E', 'S', 'H', '\0'};
+
+// O formato é little-endian e os arrays são usados sem conversão
+static void requireLittleEndian() {
+  if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) throw runtime_error("formato binário exige uma máquina little-endian");
+}
+
+static uint64_t alignTo8(uint64_t offset) {
+  return (offset + 7) & ~uint64_t(7);
+}
+
+static uint64_t alignTo16(uint64_t offset) {
+  return (offset + 15) & ~uint64_t(15);
+}
+
+// ======================================================================================================================= //
+
+void writeBinary(const string& path, const BSPDataView& data) {
+  requireLittleEndian();
+
+  BinaryHeader header;
+  memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+  header.version = BINARY_VERSION;
+  header.header_size = sizeof(BinaryHeader);
+  header.points = data.points.size();
+  header.triangles = data.triangles.size();
+  header.segments = data.segments.size();
+  header.points_offset = sizeof(BinaryHeader);
+  header.triangles_offset = alignTo8(header.points_offset + header.points * sizeof(Point3D));
+  header.segments_offset = alignTo8(header.triangles_offset + header.triangles * sizeof(Triangle));
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) throw runtime_error("não foi possível criar " + path);
+
+  // Escreve um bloco na posição indicada, preenchendo o alinhamento com zeros
+  bool ok = true;
+  uint64_t written = 0;
+  auto put = [&](uint64_t offset, const void* bytes, size_t size) {
+    static const char zeros[8] = {0};
+    if (offset > written) ok = ok && fwrite(zeros, 1, offset - written, file) == offset - written;
+    ok = ok && fwrite(bytes, 1, size, file) == size;
+    written = offset + size;
+  };
+
+  put(0, &header, sizeof(header));
+  put(header.points_offset, data.points.data(), header.points * sizeof(Point3D));
+  put(header.triangles_offset, data.triangles.data(), header.triangles * sizeof(Triangle));
+  put(header.segments_offset, data.segments.data(), header.segments * sizeof(Segment));
+
+  if (fclose(file) != 0 || !ok) throw runtime_error("erro ao escrever " + path);
+}
+
+// ======================================================================================================================= //
+
+MappedFile::MappedFile(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw runtime_error("não foi possível abrir " + path);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw runtime_error(path + ": arquivo vazio");
+  }
+  size_ = st.st_size;
+  map_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map_ == MAP_FAILED) throw runtime_error("não foi possível mapear " + path);
+}
+
+MappedFile::~MappedFile() {
+  munmap(map_, size_);
+}
+
+// Os predicados geométricos só são exatos com |coord| < COORD_LIMIT
+static bool inRange(const Point3D& p) {
+  return abs((long long)p.x) < COORD_LIMIT && abs((long long)p.y) < COORD_LIMIT && abs((long long)p.z) < COORD_LIMIT;
+}
+
+// ======================================================================================================================= //
+
+// Verifica se um array de count itens de item bytes em offset cabe no arquivo e está alinhado
+static void checkArray(const MappedFile& file, const string& path, uint64_t offset, uint64_t count, size_t item, size_t align, const char* name) {
+  if (offset % align != 0 || offset > file.size() || count > (file.size() - offset) / item)
+    throw runtime_error(path + ": array de " + name + " fora do arquivo");
+}
+
+MappedBinary::MappedBinary(const string& path) : file_(path) {
+  requireLittleEndian();
+
+  if (file_.size() < sizeof(BinaryHeader)) throw runtime_error(path + ": arquivo binário truncado");
+  const char* base = file_.data();
+  const BinaryHeader& header = *reinterpret_cast<const BinaryHeader*>(base);
+  if (memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) throw runtime_error(path + ": assinatura inválida");
+  if (header.version != BINARY_VERSION) throw runtime_error(path + ": versão " + to_string(header.version) + " não suportada");
+  if (header.header_size != sizeof(BinaryHeader)) throw runtime_error(path + ": tamanho de cabeçalho inválido");
+
+  // Cada array precisa caber no arquivo e estar alinhado para acesso direto
+  checkArray(file_, path, header.points_offset, header.points, sizeof(Point3D), 8, "pontos");
+  checkArray(file_, path, header.triangles_offset, header.triangles, sizeof(Triangle), 8, "triângulos");
+  checkArray(file_, path, header.segments_offset, header.segments, sizeof(Segment), 8, "segmentos");
+
+  view_ = BSPDataView(
+    Span<Point3D>(reinterpret_cast<const Point3D*>(base + header.points_offset), header.points),
+    Span<Triangle>(reinterpret_cast<const Triangle*>(base + header.triangles_offset), header.triangles),
+    Span<Segment>(reinterpret_cast<const Segment*>(base + header.segments_offset), header.segments));
+
+  for (const Point3D& p : view_.points) {
+    if (!inRange(p)) throw runtime_error(path + ": coordenada de ponto fora do intervalo suportado");
+  }
+  for (const Segment& seg : view_.segments) {
+    if (!inRange(seg.p1) || !inRange(seg.p2)) throw runtime_error(path + ": coordenada de segmento fora do intervalo suportado");
+  }
+
+  // As rotinas da BSP indexam os pontos sem verificação
+  long long n = header.points;
+  for (const Triangle& tri : view_.triangles) {
+    if (tri.a < 1 || tri.a > n || tri.b < 1 || tri.b > n || tri.c < 1 || tri.c > n)
+      throw runtime_error(path + ": triângulo com índice de vértice inválido");
+  }
+}
+
+// ======================================================================================================================= //
+
+SegmentBatchReader::SegmentBatchReader(int fd) : fd_(fd) {
+  requireLittleEndian();
+}
+
+// Lê exatamente size bytes; false se a entrada terminou antes do primeiro byte
+bool SegmentBatchReader::readFully(void* bytes, size_t size) {
+  char* out = static_cast<char*>(bytes);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t got = read(fd_, out + done, size - done);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) {
+      if (done == 0) return false;
+      throw runtime_error("lote de segmentos truncado");
+    }
+    done += got;
+  }
+  return true;
+}
+
+bool SegmentBatchReader::next(vector<Segment>& batch, size_t max_batch) {
+  if (remaining_ == 0 && !readFully(&remaining_, sizeof(remaining_))) return false;
+
+  size_t count = min((size_t)remaining_, max(max_batch, (size_t)1));
+  batch.resize(count, Segment(0, 0, 0, 0, 0, 0));
+  if (count > 0 && !readFully(batch.data(), count * sizeof(Segment))) throw runtime_error("lote de segmentos truncado");
+  remaining_ -= count;
+
+  for (const Segment& seg : batch) {
+    if (!inRange(seg.p1) || !inRange(seg.p2)) throw runtime_error("coordenada de segmento fora do intervalo suportado");
+  }
+  return true;
+}
+
+// ======================================================================================================================= //
+
+static const char TREE_MAGIC[8] = {'B', 'S', 'P', 'T', 'R', 'E', 'E', '\0'};
+
+uint64_t meshChecksum(const BSPDataView& data) {
+  uint64_t hash = 1469598103934665603ULL;
+  auto mix = [&](const void* bytes, size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < size; ++i) {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+    }
+  };
+  uint64_t counts[2] = {data.points.size(), data.triangles.size()};
+  mix(counts, sizeof(counts));
+  mix(data.points.data(), data.points.size() * sizeof(Point3D));
+  mix(data.triangles.data(), data.triangles.size() * sizeof(Triangle));
+  return hash;
+}
+
+void writeTree(const string& path, const FlatBSPView& tree, const BSPDataView& data) {
+  requireLittleEndian();
+
+  TreeHeader header;
+  memcpy(header.magic, TREE_MAGIC, sizeof(header.magic));
+  header.version = TREE_VERSION;
+  header.header_size = sizeof(TreeHeader);
+  header.mesh_checksum = meshChecksum(data);
+  header.points = data.points.size();
+  header.triangles = data.triangles.size();
+  header.nodes = tree.nodes.size();
+  header.nodes_offset = alignTo16(sizeof(TreeHeader));
+  header.wide_planes = tree.wide_planes.size();
+  header.wide_planes_offset = alignTo16(header.nodes_offset + header.nodes * sizeof(FlatNode));
+  header.leaf_triangles = tree.leaf_triangles.size();
+  header.leaf_triangles_offset = alignTo16(header.wide_planes_offset + header.wide_planes * sizeof(WidePlane));
+  header.boxes = tree.boxes.size();
+  header.boxes_offset = alignTo16(header.leaf_triangles_offset + header.leaf_triangles * sizeof(int));
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) throw runtime_error("não foi possível criar " + path);
+
+  // Escreve um bloco na posição indicada, preenchendo o alinhamento com zeros
+  bool ok = true;
+  uint64_t written = 0;
+  auto put = [&](uint64_t offset, const void* bytes, size_t size) {
+    static const char zeros[16] = {0};
+    if (offset > written) ok = ok && fwrite(zeros, 1, offset - written, file) == offset - written;
+    ok = ok && fwrite(bytes, 1, size, file) == size;
+    written = offset + size;
+  };
+
+  put(0, &header, sizeof(header));
+  put(header.nodes_offset, tree.nodes.data(), header.nodes * sizeof(FlatNode));
+  put(header.wide_planes_offset, tree.wide_planes.data(), header.wide_planes * sizeof(WidePlane));
+  put(header.leaf_triangles_offset, tree.leaf_triangles.data(), header.leaf_triangles * sizeof(int));
+  put(header.boxes_offset, tree.boxes.data(), header.boxes * sizeof(NodeBox));
+
+  if (fclose(file) != 0 || !ok) throw runtime_error("erro ao escrever " + path);
+}
+
+MappedTree::MappedTree(const string& path, const BSPDataView& data) : file_(path) {
+  requireLittleEndian();
+
+  if (file_.size() < sizeof(TreeHeader)) throw runtime_error(path + ": arquivo de árvore truncado");
+  const char* base = file_.data();
+  const TreeHeader& header = *reinterpret_cast<const TreeHeader*>(base);
+  if (memcmp(header.magic, TREE_MAGIC, sizeof(TREE_MAGIC)) != 0) throw runtime_error(path + ": assinatura inválida");
+  if (header.version != TREE_VERSION) throw runtime_error(path + ": versão " + to_string(header.version) + " não suportada");
+  if (header.header_size != sizeof(TreeHeader)) throw runtime_error(path + ": tamanho de cabeçalho inválido");
+  if (header.points != data.points.size() || header.triangles != data.triangles.size() || header.mesh_checksum != meshChecksum(data))
+    throw runtime_error(path + ": árvore construída para outra malha");
+
+  checkArray(file_, path, header.nodes_offset, header.nodes, sizeof(FlatNode), 16, "nós");
+  checkArray(file_, path, header.wide_planes_offset, header.wide_planes, sizeof(WidePlane), 16, "planos largos");
+  checkArray(file_, path, header.leaf_triangles_offset, header.leaf_triangles, sizeof(int), 16, "baldes");
+  checkArray(file_, path, header.boxes_offset, header.boxes, sizeof(NodeBox), 16, "caixas");
+  if (header.boxes != header.nodes) throw runtime_error(path + ": número de caixas diferente do número de nós");
+  view_ = FlatBSPView(
+    Span<FlatNode>(reinterpret_cast<const FlatNode*>(base + header.nodes_offset), header.nodes),
+    Span<WidePlane>(reinterpret_cast<const WidePlane*>(base + header.wide_planes_offset), header.wide_planes),
+    Span<int>(reinterpret_cast<const int*>(base + header.leaf_triangles_offset), header.leaf_triangles),
+    Span<NodeBox>(reinterpret_cast<const NodeBox*>(base + header.boxes_offset), header.boxes));
+
+  // A consulta segue filhos, triângulos, planos largos e baldes sem verificação. flattenBSP grava os nós em
+  // pré-ordem, então todo filho vem depois do pai; um filho anterior (ou o próprio nó) formaria um ciclo.
+  for (size_t i = 0; i < view_.nodes.size(); ++i) {
+    const FlatNode& node = view_.nodes[i];
+    auto badChild = [&](uint32_t child) { return child != FLAT_NONE && (child <= i || child >= header.nodes); };
+    bool bad_child = badChild(node.front) || badChild(node.back);
+    bool bad_reference;
+    if (node.nx == FLAT_LEAF) {
+      bad_reference = node.d < 0 || node.triangle_index < 0 || (uint64_t)node.d + node.triangle_index > header.leaf_triangles;
+    } else {
+      bool bad_plane = node.nx == FLAT_WIDE && (node.d < 0 || (uint64_t)node.d >= header.wide_planes);
+      bad_reference = bad_plane || node.triangle_index < 0 || (uint64_t)node.triangle_index >= header.triangles;
+    }
+    if (bad_child || bad_reference) throw runtime_error(path + ": nó com referência inválida");
+  }
+  for (int tri : view_.leaf_triangles) {
+    if (tri < 0 || (uint64_t)tri >= header.triangles) throw runtime_error(path + ": balde com triângulo inválido");
+  }
+}
@@ -0,0 +1,205 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef BINARY_HPP
+#define BINARY_HPP
+
+#include "bsp.hpp"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+const uint32_t BINARY_VERSION = 1;
+
+/**
+ * Cabeçalho do formato binário de malha/segmentos (little-endian, 64 bytes).
+ * Os arrays vêm depois do cabeçalho, alinhados a 8 bytes, com exatamente o layout em memória de
+ * Point3D, Triangle e Segment (inteiros de 32 bits empacotados), para que possam ser usados direto do mmap.
+ */
+struct BinaryHeader {
+  char magic[8];                // "BSPMESH\0"
+  uint32_t version;             // BINARY_VERSION
+  uint32_t header_size;         // sizeof(BinaryHeader)
+  uint64_t points;              // Quantidade de pontos
+  uint64_t triangles;           // Quantidade de triângulos
+  uint64_t segments;            // Quantidade de segmentos
+  uint64_t points_offset;       // Deslocamentos dos arrays a partir do início do arquivo
+  uint64_t triangles_offset;
+  uint64_t segments_offset;
+};
+
+static_assert(sizeof(BinaryHeader) == 64, "cabeçalho binário deve ter 64 bytes");
+static_assert(sizeof(Point3D) == 12 && sizeof(Triangle) == 12 && sizeof(Segment) == 24, "layout empacotado esperado");
+
+const uint32_t TREE_VERSION = 4;
+
+/**
+ * Cabeçalho do arquivo de árvore (little-endian, 104 bytes), seguido do array de FlatNode, do array de
+ * WidePlane, dos baldes das folhas e das caixas dos nós, alinhados a 16 bytes.
+ * A soma de verificação da malha impede que a árvore seja usada com pontos ou triângulos diferentes
+ * daqueles sobre os quais foi construída.
+ */
+struct TreeHeader {
+  char magic[8];                // "BSPTREE\0"
+  uint32_t version;             // TREE_VERSION
+  uint32_t header_size;         // sizeof(TreeHeader)
+  uint64_t mesh_checksum;       // meshChecksum() da malha de origem
+  uint64_t points;              // Quantidade de pontos da malha de origem
+  uint64_t triangles;           // Quantidade de triângulos da malha de origem
+  uint64_t nodes;               // Quantidade de nós
+  uint64_t nodes_offset;        // Deslocamento do array de nós a partir do início do arquivo
+  uint64_t wide_planes;         // Quantidade de planos largos (coordenadas grandes)
+  uint64_t wide_planes_offset;  // Deslocamento do array de planos largos
+  uint64_t leaf_triangles;      // Quantidade de índices nos baldes das folhas
+  uint64_t leaf_triangles_offset; // Deslocamento do array dos baldes
+  uint64_t boxes;               // Quantidade de caixas (uma por nó)
+  uint64_t boxes_offset;        // Deslocamento do array de caixas
+};
+
+static_assert(sizeof(TreeHeader) == 104, "cabeçalho da árvore deve ter 104 bytes");
+static_assert(sizeof(NodeBox) == 24, "layout empacotado esperado");
+
+// ======================================================================================================================= //
+
+/**
+ * Arquivo mapeado somente para leitura (MAP_SHARED), liberado no destrutor.
+ * Vários processos que mapeiam o mesmo arquivo compartilham as mesmas páginas.
+ */
+class MappedFile {
+public:
+  /**
+   * @param path Caminho do arquivo
+   * @throws runtime_error se o arquivo não puder ser aberto ou mapeado
+   */
+  explicit MappedFile(const string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return static_cast<const char*>(map_); }
+  size_t size() const { return size_; }
+
+private:
+  void* map_ = nullptr;
+  size_t size_ = 0;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Escreve os dados no formato binário.
+ * @param path Caminho do arquivo de saída
+ * @param data Dados a serem gravados
+ * @throws runtime_error em caso de erro de escrita
+ */
+void writeBinary(const string& path, const BSPDataView& data);
+
+/**
+ * Arquivo binário mapeado em memória. Os arrays são vistos diretamente no mapeamento, sem cópia,
+ * e continuam válidos enquanto o objeto existir.
+ */
+class MappedBinary {
+public:
+  /**
+   * Mapeia e valida o arquivo (assinatura, versão, limites dos arrays, índices dos triângulos e
+   * módulo das coordenadas, que precisa ficar abaixo de COORD_LIMIT).
+   * @param path Caminho do arquivo
+   * @throws runtime_error se o arquivo não puder ser aberto ou for inválido
+   */
+  explicit MappedBinary(const string& path);
+
+  /**
+   * @return Visão dos pontos, triângulos e segmentos do arquivo
+   */
+  BSPDataView view() const { return view_; }
+
+private:
+  MappedFile file_;
+  BSPDataView view_;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Leitor de segmentos em lotes binários, usado no modo de fluxo. Cada lote é um uint32_t com a quantidade
+ * de segmentos seguido dos segmentos no layout de Segment (seis inteiros de 32 bits, little-endian).
+ * Lotes maiores que o limite pedido são entregues em partes, então a memória não depende do remetente.
+ */
+class SegmentBatchReader {
+public:
+  /**
+   * @param fd Descritor de onde ler (0 para a entrada padrão)
+   */
+  explicit SegmentBatchReader(int fd);
+
+  /**
+   * Lê os próximos segmentos do lote atual ou, se ele acabou, do próximo.
+   * @param batch Substituído pelos segmentos lidos
+   * @param max_batch Maior quantidade de segmentos entregue de uma vez
+   * @return false se a entrada terminou entre dois lotes
+   * @throws runtime_error se a entrada terminar no meio de um lote ou uma coordenada for inválida
+   */
+  bool next(vector<Segment>& batch, size_t max_batch);
+
+private:
+  bool readFully(void* bytes, size_t size);
+
+  int fd_;
+  uint32_t remaining_ = 0;      // Segmentos do lote atual ainda não lidos
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Soma de verificação (FNV-1a de 64 bits) dos pontos e triângulos de uma malha.
+ * @param data Malha
+ * @return Soma de verificação
+ */
+uint64_t meshChecksum(const BSPDataView& data);
+
+/**
+ * Grava uma BSP linearizada em arquivo.
+ * @param path Caminho do arquivo de saída
+ * @param tree Árvore a ser gravada
+ * @param data Malha sobre a qual a árvore foi construída
+ * @throws runtime_error em caso de erro de escrita
+ */
+void writeTree(const string& path, const FlatBSPView& tree, const BSPDataView& data);
+
+/**
+ * Árvore gravada por writeTree, mapeada em memória. Os nós são usados direto do mapeamento,
+ * então a consulta dispensa a construção e o arquivo pode ser compartilhado entre processos.
+ */
+class MappedTree {
+public:
+  /**
+   * Mapeia e valida o arquivo contra a malha atual.
+   * @param path Caminho do arquivo
+   * @param data Malha que será consultada; precisa ser a mesma usada na construção
+   * @throws runtime_error se o arquivo for inválido ou tiver sido construído para outra malha
+   */
+  MappedTree(const string& path, const BSPDataView& data);
+
+  /**
+   * @return Visão da árvore mapeada
+   */
+  FlatBSPView view() const { return view_; }
+
+private:
+  MappedFile file_;
+  FlatBSPView view_;
+};
+
+#endif // BINARY_HPP
@@ -10,8 +10,16 @@
  ************************************************************************/
 
 #include "bsp.hpp"
+#include "packet.hpp"
+#include "index.hpp"
 #include <algorithm>
-#include <cmath>
+#include <tuple>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <chrono>
 
 using namespace std;
 
@@ -20,23 +28,90 @@ using namespace std;
 Plane computePlane(const Point3D& p1, const Point3D& p2, const Point3D& p3) {
   Point3D u = p2 - p1;
   Point3D v = p3 - p1;
-  Point3D normal = u.cross(v);
+  Vec3L normal = u.cross(v);
   return Plane(p1, normal);
 }
 
 // ======================================================================================================================= //
 
+// Sinal exato de n · v, com |v| < 2^31. Se as componentes da normal ficam abaixo de 2^30, cada produto
+// fica abaixo de 2^61 e a soma cabe em 64 bits (caso de praticamente toda malha); senão usa 128 bits.
+static inline int signOfDot(const Vec3L& n, const Point3D& v) {
+  unsigned long long magnitude = llabs(n.x) | llabs(n.y) | llabs(n.z);
+  if (magnitude < (1ULL << 30)) {
+    long long s = n.x * v.x + n.y * v.y + n.z * v.z;
+    return (s > 0) - (s < 0);
+  }
+  Int128 s = n.dot(v);
+  return (s > 0) - (s < 0);
+}
+
 int classifyPointToPlane(const Plane& plane, const Point3D& point) {
-  Point3D diff = point - plane.point;
-  int dotProduct = plane.normal.dot(diff);
-  if (dotProduct > 0) return 1;    // Front
-  if (dotProduct < 0) return -1;   // Back
-  return 0;                        // Coplanar
+  return signOfDot(plane.normal, point - plane.point); // 1 (frente), -1 (trás), 0 (coplanar)
 }
 
 // ======================================================================================================================= //
 
-Position classifyTriangle(const Plane& plane, const Triangle& tri, const vector<Point3D>& points) {
+static void resizeCache(TriangleCache& cache, size_t n) {
+  for (vector<int>* v : {&cache.x0, &cache.y0, &cache.z0, &cache.e1x, &cache.e1y, &cache.e1z, &cache.e2x, &cache.e2y, &cache.e2z}) v->resize(n);
+  for (vector<long long>* v : {&cache.nx, &cache.ny, &cache.nz, &cache.d}) v->resize(n);
+}
+
+// Preenche a entrada i do cache com o triângulo p0 p1 p2
+static void setCachedTriangle(TriangleCache& cache, size_t i, const Point3D& p0, const Point3D& p1, const Point3D& p2) {
+  Point3D e1 = p1 - p0;
+  Point3D e2 = p2 - p0;
+  Vec3L normal = e1.cross(e2);
+
+  cache.x0[i] = p0.x;  cache.y0[i] = p0.y;  cache.z0[i] = p0.z;
+  cache.e1x[i] = e1.x; cache.e1y[i] = e1.y; cache.e1z[i] = e1.z;
+  cache.e2x[i] = e2.x; cache.e2y[i] = e2.y; cache.e2z[i] = e2.z;
+  cache.nx[i] = normal.x; cache.ny[i] = normal.y; cache.nz[i] = normal.z;
+
+  unsigned long long magnitude = llabs(normal.x) | llabs(normal.y) | llabs(normal.z);
+  cache.d[i] = magnitude < (1ULL << 30) ? normal.x * p0.x + normal.y * p0.y + normal.z * p0.z : 0;
+
+  for (const Point3D* p : {&p0, &p1, &p2}) cache.max_coord = max({cache.max_coord, abs(p->x), abs(p->y), abs(p->z)});
+}
+
+TriangleCache buildTriangleCache(Span<Triangle> triangles, Span<Point3D> points) {
+  TriangleCache cache;
+  size_t n = triangles.size();
+  resizeCache(cache, n);
+
+  for (size_t i = 0; i < n; ++i) {
+    const Triangle& tri = triangles[i];
+    setCachedTriangle(cache, i, points[tri.a - 1], points[tri.b - 1], points[tri.c - 1]);
+  }
+  return cache;
+}
+
+void appendTriangle(TriangleCache& cache, const Point3D& a, const Point3D& b, const Point3D& c) {
+  size_t i = cache.size();
+  resizeCache(cache, i + 1);
+  setCachedTriangle(cache, i, a, b, c);
+}
+
+void reserveTriangleCache(TriangleCache& cache, size_t n) {
+  for (vector<int>* v : {&cache.x0, &cache.y0, &cache.z0, &cache.e1x, &cache.e1y, &cache.e1z, &cache.e2x, &cache.e2y, &cache.e2z}) v->reserve(n);
+  for (vector<long long>* v : {&cache.nx, &cache.ny, &cache.nz, &cache.d}) v->reserve(n);
+}
+
+// Lado de p em relação ao plano do triângulo i do cache. Com |n| < 2^30, n · p e d ficam abaixo de 3 * 2^60
+// e a diferença cabe em 64 bits; caso contrário o plano não tem d guardado e o cálculo parte de p0.
+static inline int classifyPointToCachedPlane(const TriangleCache& cache, size_t i, const Point3D& p) {
+  long long nx = cache.nx[i], ny = cache.ny[i], nz = cache.nz[i];
+  unsigned long long magnitude = llabs(nx) | llabs(ny) | llabs(nz);
+  if (magnitude < (1ULL << 30)) {
+    long long s = nx * p.x + ny * p.y + nz * p.z - cache.d[i];
+    return (s > 0) - (s < 0);
+  }
+  return signOfDot(cache.normal(i), p - cache.vertex(i, 0));
+}
+
+// ======================================================================================================================= //
+
+Position classifyTriangle(const Plane& plane, const Triangle& tri, Span<Point3D> points) {
   int aSide = classifyPointToPlane(plane, points[tri.a - 1]);
   int bSide = classifyPointToPlane(plane, points[tri.b - 1]);
   int cSide = classifyPointToPlane(plane, points[tri.c - 1]);
@@ -47,48 +122,692 @@ Position classifyTriangle(const Plane& plane, const Triangle& tri, const vector<
   return Position::SPANNING;
 }
 
+Position classifyTriangle(const Plane& plane, const TriangleCache& cache, int index) {
+  int aSide = classifyPointToPlane(plane, cache.vertex(index, 0));
+  int bSide = classifyPointToPlane(plane, cache.vertex(index, 1));
+  int cSide = classifyPointToPlane(plane, cache.vertex(index, 2));
+
+  if (aSide == 0 && bSide == 0 && cSide == 0) return Position::COPLANAR;
+  if (aSide >= 0 && bSide >= 0 && cSide >= 0) return Position::FRONT;
+  if (aSide <= 0 && bSide <= 0 && cSide <= 0) return Position::BACK;
+  return Position::SPANNING;
+}
+
+// ======================================================================================================================= //
+
+// Mistura de bits (splitmix64), usada para derivar sementes independentes para cada nó
+static unsigned long long mixSeed(unsigned long long x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Caixa alinhada aos eixos usada pela heurística de área de superfície
+struct SplitBox {
+  long long lo[3] = {0, 0, 0};
+  long long hi[3] = {0, 0, 0};
+  bool empty = true;
+
+  void add(const Point3D& p) {
+    long long c[3] = {p.x, p.y, p.z};
+    for (int k = 0; k < 3; ++k) {
+      if (empty || c[k] < lo[k]) lo[k] = c[k];
+      if (empty || c[k] > hi[k]) hi[k] = c[k];
+    }
+    empty = false;
+  }
+
+  void add(const TriangleCache& cache, int index) {
+    for (int k = 0; k < 3; ++k) add(cache.vertex(index, k));
+  }
+
+  double area() const {
+    if (empty) return 0.0;
+    double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+  }
+};
+
+// Custo de usar triangle_indices[pos] como divisor. Spans pesam mais que o desbalanceamento,
+// pois cada um duplica o triângulo nas duas subárvores.
+static double splitCost(const TriangleCache& cache, const int* triangle_indices, size_t count, size_t pos, SplitStrategy strategy) {
+  Plane plane = cache.plane(triangle_indices[pos]);
+
+  int front = 0, back = 0, spans = 0;
+  SplitBox front_box, back_box, all_box;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (i == pos) continue;
+    int tri = triangle_indices[i];
+    Position side = classifyTriangle(plane, cache, tri);
+
+    bool to_front = (side != Position::BACK);
+    bool to_back = (side == Position::BACK || side == Position::SPANNING);
+    if (to_front && to_back) spans++;
+    if (to_front) front++;
+    if (to_back) back++;
+
+    if (strategy == SplitStrategy::SAH) {
+      if (to_front) front_box.add(cache, tri);
+      if (to_back) back_box.add(cache, tri);
+      all_box.add(cache, tri);
+    }
+  }
+
+  if (strategy == SplitStrategy::SAH) {
+    double area = all_box.area();
+    if (area > 0) return (front_box.area() * front + back_box.area() * back) / area;
+    return front + back;
+  }
+
+  const double span_weight = 8.0;
+  return span_weight * spans + abs(front - back);
+}
+
+// ======================================================================================================================= //
+
+bool parseSplitStrategy(const string& name, SplitStrategy& strategy) {
+  if (name == "first") strategy = SplitStrategy::FIRST;
+  else if (name == "random") strategy = SplitStrategy::RANDOM;
+  else if (name == "balanced") strategy = SplitStrategy::BALANCED;
+  else if (name == "sah") strategy = SplitStrategy::SAH;
+  else return false;
+  return true;
+}
+
+const char* splitStrategyName(SplitStrategy strategy) {
+  switch (strategy) {
+    case SplitStrategy::FIRST: return "first";
+    case SplitStrategy::RANDOM: return "random";
+    case SplitStrategy::BALANCED: return "balanced";
+    case SplitStrategy::SAH: return "sah";
+  }
+  return "?";
+}
+
+size_t chooseSplitter(const TriangleCache& cache, const int* triangle_indices, size_t count, const BuildOptions& options, unsigned long long seed) {
+  size_t n = count;
+  if (options.strategy == SplitStrategy::FIRST || n == 1) return 0;
+
+  // BALANCED avalia todos; RANDOM e SAH avaliam até k candidatos sorteados
+  bool exhaustive = options.strategy == SplitStrategy::BALANCED || n <= (size_t)max(options.candidates, 1);
+  size_t samples = exhaustive ? n : (size_t)max(options.candidates, 1);
+
+  size_t best = 0;
+  double best_cost = 0;
+  for (size_t s = 0; s < samples; ++s) {
+    size_t pos = s;
+    if (!exhaustive) {
+      seed = mixSeed(seed);
+      pos = seed % n;
+    }
+    double cost = splitCost(cache, triangle_indices, count, pos, options.strategy);
+    if (s == 0 || cost < best_cost) {
+      best = pos;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+// ======================================================================================================================= //
+
+// Divisão exata de triângulos SPANNING (BuildOptions::split_spanning). Os vértices dos fragmentos são
+// guardados em coordenadas homogêneas inteiras e cada aresta lembra a reta que a suporta: uma aresta
+// original do triângulo ou a interseção do plano do triângulo com um plano divisor. Assim todo vértice
+// novo sai de uma interseção de três planos da entrada, e os números não crescem com a profundidade.
+
+// Plano com coeficientes inteiros: n · x = d
+struct ExactPlane {
+  long long n[3] = {0, 0, 0};
+  long long d = 0;
+};
+
+// Só é usado com coordenadas dentro de canSplitExactly, onde d cabe em 64 bits
+static ExactPlane exactPlane(const Plane& plane) {
+  ExactPlane e;
+  e.n[0] = plane.normal.x;
+  e.n[1] = plane.normal.y;
+  e.n[2] = plane.normal.z;
+  e.d = (long long)plane.normal.dot(plane.point);
+  return e;
+}
+
+// Vértice de fragmento em coordenadas homogêneas: (c[0]/w, c[1]/w, c[2]/w), com w > 0
+struct HomPoint {
+  Int128 c[3];
+  Int128 w;
+};
+
+// Reta suporte de uma aresta de fragmento
+struct FragmentEdge {
+  int from = 0, to = 0;   // Cantos (1 a 3) da aresta original no triângulo; 0 se a aresta veio de um corte
+  ExactPlane plane;       // Plano divisor que gerou a aresta, quando from == 0
+};
+
+// Pedaço convexo de um triângulo da entrada. vertices vazio indica o triângulo inteiro.
+// Vértices e arestas vêm da arena de rascunho da tarefa que criou o fragmento.
+struct Fragment {
+  int triangle;
+  pmr::vector<HomPoint> vertices;
+  pmr::vector<FragmentEdge> edges;   // edges[i] liga vertices[i] a vertices[i + 1]
+
+  Fragment(int triangle, pmr::memory_resource* memory) : triangle(triangle), vertices(memory), edges(memory) {}
+  Fragment(const Fragment& other, pmr::memory_resource* memory)
+    : triangle(other.triangle), vertices(other.vertices, memory), edges(other.edges, memory) {}
+};
+
+// Estado compartilhado por todas as tarefas de construção (somente leitura, exceto os contadores)
+struct BuildContext {
+  const TriangleCache& cache;
+  const BuildOptions& options;
+  bool split;                   // Divide triângulos SPANNING em vez de duplicá-los
+  atomic<int> extra_threads;    // Threads ainda disponíveis para novas tarefas
+  CountingResource* memory;     // Origem de toda a memória da construção
+  atomic<size_t> spanning{0};   // Itens SPANNING enviados aos dois lados de nós internos
+};
+
+// Primeiro bloco da arena de nós de cada tarefa; os seguintes crescem em progressão geométrica
+const size_t NODE_ARENA_BLOCK = 64 * 1024;
+
+// Estado de uma tarefa de construção. Os índices formam uma pilha: o nó em construção ocupa o topo,
+// particiona sua faixa no próprio lugar e deixa as faixas dos filhos logo acima. Cada tarefa tem sua
+// própria pilha, seus próprios fragmentos e suas próprias arenas, então tarefas paralelas não
+// compartilham nada mutável.
+struct BuildTask {
+  unique_ptr<pmr::monotonic_buffer_resource> scratch;         // Vértices e arestas dos fragmentos; declarado antes deles para ser liberado depois
+  vector<unique_ptr<pmr::monotonic_buffer_resource>> arenas;  // arenas[0] recebe os nós desta tarefa; as demais vêm das tarefas filhas
+  pmr::vector<int> items;           // Índices de triângulos, ou de fragmentos com split
+  pmr::vector<Fragment> fragments;  // Com split, os índices da pilha apontam para cá
+  pmr::vector<int> triangle_ids;    // Triângulo original de cada item do nó atual (split)
+  pmr::vector<Position> sides;      // Classificação de cada item do nó atual
+  pmr::vector<int> bucket;          // Balde da folha em construção
+
+  explicit BuildTask(CountingResource* memory)
+    : scratch(make_unique<pmr::monotonic_buffer_resource>(memory)),
+      items(memory), fragments(memory), triangle_ids(memory), sides(memory), bucket(memory) {
+    arenas.push_back(make_unique<pmr::monotonic_buffer_resource>(NODE_ARENA_BLOCK, memory));
+  }
+};
+
+static_assert(is_trivially_destructible<BSPNode>::value, "nós da arena são liberados sem destrutor");
+
+// Novo nó na arena da tarefa
+static BSPNode* newNode(BuildTask& task) {
+  return new (task.arenas[0]->allocate(sizeof(BSPNode), alignof(BSPNode))) BSPNode();
+}
+
+static int signOf(Int128 v) {
+  return (v > 0) - (v < 0);
+}
+
+static int classifyHomPoint(const ExactPlane& plane, const HomPoint& p) {
+  Int128 s = plane.n[0] * p.c[0] + plane.n[1] * p.c[1] + plane.n[2] * p.c[2] - (Int128)plane.d * p.w;
+  return signOf(s);
+}
+
+static HomPoint homPoint(const Point3D& p) {
+  return HomPoint{{p.x, p.y, p.z}, 1};
+}
+
+// Interseção da reta que passa por dois pontos inteiros com o plano
+static HomPoint intersectEdge(const ExactPlane& plane, const Point3D& p, const Point3D& q) {
+  Int128 sp = plane.n[0] * p.x + plane.n[1] * p.y + plane.n[2] * p.z - plane.d;
+  Int128 sq = plane.n[0] * q.x + plane.n[1] * q.y + plane.n[2] * q.z - plane.d;
+  HomPoint r{{sp * q.x - sq * p.x, sp * q.y - sq * p.y, sp * q.z - sq * p.z}, sp - sq};
+  if (r.w < 0) {
+    for (int k = 0; k < 3; ++k) r.c[k] = -r.c[k];
+    r.w = -r.w;
+  }
+  return r;
+}
+
+// Interseção de três planos pela regra de Cramer
+static HomPoint intersectPlanes(const ExactPlane& p1, const ExactPlane& p2, const ExactPlane& p3) {
+  auto cross = [](const ExactPlane& u, const ExactPlane& v, Int128 out[3]) {
+    out[0] = (Int128)u.n[1] * v.n[2] - (Int128)u.n[2] * v.n[1];
+    out[1] = (Int128)u.n[2] * v.n[0] - (Int128)u.n[0] * v.n[2];
+    out[2] = (Int128)u.n[0] * v.n[1] - (Int128)u.n[1] * v.n[0];
+  };
+  Int128 c23[3], c31[3], c12[3];
+  cross(p2, p3, c23);
+  cross(p3, p1, c31);
+  cross(p1, p2, c12);
+
+  HomPoint r;
+  r.w = p1.n[0] * c23[0] + p1.n[1] * c23[1] + p1.n[2] * c23[2];
+  for (int k = 0; k < 3; ++k) r.c[k] = p1.d * c23[k] + p2.d * c31[k] + p3.d * c12[k];
+  if (r.w < 0) {
+    for (int k = 0; k < 3; ++k) r.c[k] = -r.c[k];
+    r.w = -r.w;
+  }
+  return r;
+}
+
+static Position classifyFragment(const ExactPlane& plane, const Fragment& frag) {
+  bool front = false, back = false;
+  for (const HomPoint& v : frag.vertices) {
+    int side = classifyHomPoint(plane, v);
+    front |= side > 0;
+    back |= side < 0;
+  }
+  if (!front && !back) return Position::COPLANAR;
+  if (!back) return Position::FRONT;
+  if (!front) return Position::BACK;
+  return Position::SPANNING;
+}
+
+// Recorta o fragmento mantendo o lado keep (+1 frente, -1 trás) do plano
+static Fragment clipFragment(const BuildContext& ctx, const Fragment& frag, const ExactPlane& plane, int keep, pmr::memory_resource* memory) {
+  ExactPlane support = exactPlane(ctx.cache.plane(frag.triangle));
+
+  FragmentEdge cut;
+  cut.plane = plane;
+
+  Fragment out(frag.triangle, memory);
+  size_t m = frag.vertices.size();
+  for (size_t i = 0; i < m; ++i) {
+    const HomPoint& cur = frag.vertices[i];
+    const HomPoint& nxt = frag.vertices[(i + 1) % m];
+    const FragmentEdge& edge = frag.edges[i];
+    int sc = classifyHomPoint(plane, cur) * keep;
+    int sn = classifyHomPoint(plane, nxt) * keep;
+    bool crosses = sc * sn < 0;
+
+    // A aresta que sai de cada vértice emitido segue a original enquanto o próximo
+    // vértice emitido estiver sobre ela; caso contrário, segue o corte
+    if (sc >= 0) {
+      out.vertices.push_back(cur);
+      out.edges.push_back((sn >= 0 || crosses) ? edge : cut);
+    }
+    if (crosses) {
+      out.vertices.push_back(edge.from
+        ? intersectEdge(plane, ctx.cache.vertex(frag.triangle, edge.from - 1), ctx.cache.vertex(frag.triangle, edge.to - 1))
+        : intersectPlanes(support, edge.plane, plane));
+      out.edges.push_back(sn >= 0 ? edge : cut);
+    }
+  }
+  return out;
+}
+
+// Triângulos de área nula não têm plano próprio e não podem ser recortados
+static bool isDegenerate(const BuildContext& ctx, int triangle) {
+  return ctx.cache.normal(triangle).isZero();
+}
+
+// Converte um triângulo inteiro em polígono para poder recortá-lo
+static Fragment wholeFragment(const BuildContext& ctx, int triangle, pmr::memory_resource* memory) {
+  Fragment frag(triangle, memory);
+  for (int k = 0; k < 3; ++k) {
+    frag.vertices.push_back(homPoint(ctx.cache.vertex(triangle, k)));
+    FragmentEdge edge;
+    edge.from = k + 1;
+    edge.to = (k + 1) % 3 + 1;
+    frag.edges.push_back(edge);
+  }
+  return frag;
+}
+
+// ======================================================================================================================= //
+
+bool canSplitExactly(Span<Point3D> points) {
+  // Vértices de fragmento têm grau 7 nas coordenadas e os testes de lado grau 9; com |coord| <= 4096
+  // tudo cabe com folga em 128 bits
+  const int limit = 4096;
+  for (const Point3D& p : points)
+    if (abs(p.x) > limit || abs(p.y) > limit || abs(p.z) > limit) return false;
+  return true;
+}
+
+bool canSplitExactly(const TriangleCache& cache) {
+  return cache.max_coord <= 4096;
+}
+
 // ======================================================================================================================= //
 
-unique_ptr<BSPNode> buildBSP(const vector<Triangle>& triangles, const vector<Point3D>& points, vector<int> triangle_indices) {
-  if (triangle_indices.empty()) return nullptr;
+// Faixas a partir deste tamanho viram tarefas próprias ou têm a classificação dividida entre threads
+const size_t TASK_CUTOFF = 2048;
+const size_t PARALLEL_CLASSIFY_CUTOFF = 32768;
+
+// Classifica os itens [begin, begin + count) da tarefa contra o plano, preenchendo task.sides
+static void classifyItems(const BuildContext& ctx, BuildTask& task, size_t begin, size_t count, const Plane& plane, const ExactPlane& exact_plane) {
+  task.sides.resize(count);
+
+  auto classify = [&](size_t from, size_t to) {
+    for (size_t i = from; i < to; ++i) {
+      int idx = task.items[begin + i];
+      bool whole = !ctx.split || task.fragments[idx].vertices.empty();
+      int tri = ctx.split ? task.triangle_ids[i] : idx;
+      task.sides[i] = whole ? classifyTriangle(plane, ctx.cache, tri)
+                            : classifyFragment(exact_plane, task.fragments[idx]);
+    }
+  };
+
+  int threads = ctx.options.threads;
+  if (threads <= 1 || count < PARALLEL_CLASSIFY_CUTOFF) {
+    classify(0, count);
+    return;
+  }
+
+  // Nos níveis mais altos a faixa é grande o bastante para compensar threads dedicadas
+  vector<thread> pool;
+  size_t step = (count + threads - 1) / threads;
+  for (int t = 1; t < threads; ++t) {
+    size_t from = min(count, t * step), to = min(count, (t + 1) * step);
+    if (from < to) pool.emplace_back(classify, from, to);
+  }
+  classify(0, min(count, step));
+  for (thread& th : pool) th.join();
+}
+
+// Reserva uma thread para uma nova tarefa, se ainda houver
+static bool acquireThread(BuildContext& ctx) {
+  int available = ctx.extra_threads.load();
+  while (available > 0) {
+    if (ctx.extra_threads.compare_exchange_weak(available, available - 1)) return true;
+  }
+  return false;
+}
+
+// Move a faixa [begin, fim) da pilha da tarefa para uma tarefa nova, copiando os fragmentos usados
+static BuildTask forkTask(const BuildContext& ctx, BuildTask& task, size_t begin) {
+  BuildTask child(ctx.memory);
+  child.items.assign(task.items.begin() + begin, task.items.end());
+  task.items.resize(begin);
+  if (ctx.split) {
+    for (int& idx : child.items) {
+      child.fragments.push_back(Fragment(task.fragments[idx], child.scratch.get()));
+      idx = (int)child.fragments.size() - 1;
+    }
+  }
+  return child;
+}
+
+NodeBox triangleBox(const TriangleCache& cache, int index) {
+  NodeBox box;
+  Point3D p0 = cache.vertex(index, 0), p1 = cache.vertex(index, 1), p2 = cache.vertex(index, 2);
+  int c[3][3] = {{p0.x, p0.y, p0.z}, {p1.x, p1.y, p1.z}, {p2.x, p2.y, p2.z}};
+  for (int k = 0; k < 3; ++k) {
+    box.lo[k] = min({c[0][k], c[1][k], c[2][k]});
+    box.hi[k] = max({c[0][k], c[1][k], c[2][k]});
+  }
+  return box;
+}
+
+void growBox(NodeBox& box, const NodeBox& other) {
+  for (int k = 0; k < 3; ++k) {
+    box.lo[k] = min(box.lo[k], other.lo[k]);
+    box.hi[k] = max(box.hi[k], other.hi[k]);
+  }
+}
+
+// Folha com os triângulos dos itens [begin, fim) da pilha, mais extra se não for -1. Fragmentos do mesmo
+// triângulo viram uma só entrada.
+static BSPNode* buildLeaf(const BuildContext& ctx, BuildTask& task, size_t begin, int extra = -1) {
+  pmr::vector<int>& bucket = task.bucket;
+  bucket.clear();
+  if (extra >= 0) bucket.push_back(extra);
+  for (size_t i = begin; i < task.items.size(); ++i) {
+    int idx = task.items[i];
+    bucket.push_back(ctx.split ? task.fragments[idx].triangle : idx);
+  }
+  sort(bucket.begin(), bucket.end());
+  bucket.erase(unique(bucket.begin(), bucket.end()), bucket.end());
+  task.items.resize(begin);
+
+  // O balde é copiado do rascunho para a arena, logo depois do nó
+  BSPNode* node = newNode(task);
+  int* ids = static_cast<int*>(task.arenas[0]->allocate(bucket.size() * sizeof(int), alignof(int)));
+  copy(bucket.begin(), bucket.end(), ids);
+  node->bucket = Span<int>(ids, bucket.size());
+
+  node->box = triangleBox(ctx.cache, bucket[0]);
+  for (int tri : bucket) growBox(node->box, triangleBox(ctx.cache, tri));
+  return node;
+}
+
+// Constrói a subárvore dos itens [begin, fim) da pilha e desempilha a faixa ao terminar. A raiz tem profundidade 1.
+static BSPNode* buildBSPNode(BuildContext& ctx, BuildTask& task, size_t begin, int depth, unsigned long long seed) {
+  size_t end = task.items.size();
+  if (begin == end) return nullptr;
+  size_t count = end - begin;
+  if (count <= (size_t)max(ctx.options.leaf_size, 0)) return buildLeaf(ctx, task, begin);
+  if (ctx.options.max_depth > 0 && depth >= ctx.options.max_depth) return buildLeaf(ctx, task, begin);
+
+  // Com split, os índices são de fragmentos; a escolha do divisor olha os triângulos originais
+  if (ctx.split) {
+    task.triangle_ids.resize(count);
+    for (size_t i = 0; i < count; ++i) task.triangle_ids[i] = task.fragments[task.items[begin + i]].triangle;
+  }
+  const int* triangle_indices = ctx.split ? task.triangle_ids.data() : &task.items[begin];
 
-  int root_index = triangle_indices[0]; // Usa o primeiro triângulo como plano de divisão
-  const Triangle& root_tri = triangles[root_index];
-  Plane dividing_plane = computePlane(points[root_tri.a - 1], points[root_tri.b - 1], points[root_tri.c - 1]);
+  size_t root_pos = chooseSplitter(ctx.cache, triangle_indices, count, ctx.options, seed);
+  int root_index = triangle_indices[root_pos];
+  Plane dividing_plane = ctx.cache.plane(root_index);
+  ExactPlane exact_plane = exactPlane(dividing_plane);
 
-  vector<int> front_indices, back_indices;
+  classifyItems(ctx, task, begin, count, dividing_plane, exact_plane);
 
-  for (size_t i = 1; i < triangle_indices.size(); ++i) {
-    int idx = triangle_indices[i];
-    const Triangle& tri = triangles[idx];
-    Position pos = classifyTriangle(dividing_plane, tri, points);
+  // Partição no lugar: a frente é compactada no início da faixa, mantendo a ordem, e o verso é
+  // empilhado acima dela. A ordem de cada lado é a mesma da entrada, o que mantém a árvore idêntica
+  // entre construções serial e paralela.
+  size_t write = begin;
+  size_t spanning = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i == root_pos) continue;
+    int idx = task.items[begin + i];
+    int tri_index = ctx.split ? task.triangle_ids[i] : idx;
+    Position pos = task.sides[i];
+    spanning += pos == Position::SPANNING;
 
-    if (pos == Position::FRONT) front_indices.push_back(idx);
-    else if (pos == Position::BACK) back_indices.push_back(idx);
-    else if (pos == Position::COPLANAR) front_indices.push_back(idx); // Pode ir pra qualquer lado
-    else {
+    if (pos == Position::FRONT) task.items[write++] = idx;
+    else if (pos == Position::BACK) task.items.push_back(idx);
+    else if (pos == Position::COPLANAR) task.items[write++] = idx; // Pode ir pra qualquer lado
+    else if (ctx.split && !isDegenerate(ctx, tri_index)) {
+      // SPANNING com split: recorta em dois fragmentos que referenciam o mesmo triângulo
+      // Com espaço reservado, a referência ao fragmento de origem sobrevive aos dois push_back
+      pmr::memory_resource* scratch = task.scratch.get();
+      if (task.fragments.capacity() < task.fragments.size() + 2) task.fragments.reserve(2 * task.fragments.size() + 2);
+      Fragment whole(tri_index, scratch);
+      if (task.fragments[idx].vertices.empty()) whole = wholeFragment(ctx, tri_index, scratch);
+      const Fragment& source = whole.vertices.empty() ? task.fragments[idx] : whole;
+      task.fragments.push_back(clipFragment(ctx, source, exact_plane, 1, scratch));
+      task.items[write++] = (int)task.fragments.size() - 1;
+      task.fragments.push_back(clipFragment(ctx, source, exact_plane, -1, scratch));
+      task.items.push_back((int)task.fragments.size() - 1);
+    } else {
       // SPANNING: simplificação — envia para os dois lados
-      front_indices.push_back(idx);
-      back_indices.push_back(idx);
+      task.items[write++] = idx;
+      task.items.push_back(idx);
     }
   }
+  size_t back_count = task.items.size() - end;
+  move(task.items.begin() + end, task.items.end(), task.items.begin() + write);
+  task.items.resize(write + back_count);
 
-  auto node = make_unique<BSPNode>();
+  // Divisão que quase não reduz o maior filho (muitos SPANNING) só aprofunda a árvore: vira folha
+  size_t largest = max(write - begin, back_count);
+  if (largest + max(ctx.options.min_triangles, 1) > count) return buildLeaf(ctx, task, begin, root_index);
+  ctx.spanning += spanning;
+
+  BSPNode* node = newNode(task);
   node->triangle_index = root_index;
   node->plane = dividing_plane;
-  node->front = buildBSP(triangles, points, front_indices);
-  node->back = buildBSP(triangles, points, back_indices);
+
+  // O verso está no topo da pilha e é resolvido primeiro; grande o bastante, vira uma tarefa própria
+  if (back_count >= TASK_CUTOFF && acquireThread(ctx)) {
+    BuildTask back_task = forkTask(ctx, task, write);
+    auto back = async(launch::async, [&ctx, &back_task, depth, seed]() {
+      auto subtree = buildBSPNode(ctx, back_task, 0, depth + 1, mixSeed(seed ^ 2));
+      ctx.extra_threads++;
+      return subtree;
+    });
+    node->front = buildBSPNode(ctx, task, begin, depth + 1, mixSeed(seed ^ 1));
+    node->back = back.get();
+
+    // Os nós da tarefa filha ficam nas arenas dela, que passam a ser desta
+    for (auto& arena : back_task.arenas) task.arenas.push_back(move(arena));
+  } else {
+    node->back = buildBSPNode(ctx, task, write, depth + 1, mixSeed(seed ^ 2));
+    node->front = buildBSPNode(ctx, task, begin, depth + 1, mixSeed(seed ^ 1));
+  }
+
+  // Com split os fragmentos entram com a caixa do triângulo inteiro, o que só deixa a caixa mais folgada
+  node->box = triangleBox(ctx.cache, root_index);
+  if (node->front) growBox(node->box, node->front->box);
+  if (node->back) growBox(node->box, node->back->box);
   return node;
 }
 
+BSPTree buildBSP(Span<Triangle> triangles, Span<Point3D> points, vector<int> triangle_indices, const BuildOptions& options) {
+  TriangleCache cache = buildTriangleCache(triangles, points);
+  return buildBSP(cache, move(triangle_indices), options);
+}
+
+BSPTree buildBSP(const TriangleCache& cache, vector<int> triangle_indices, const BuildOptions& options) {
+  BSPTree tree;
+  tree.memory = make_unique<CountingResource>();
+  // threads <= 0 usa todos os núcleos, como nas consultas
+  BuildOptions resolved = options;
+  if (resolved.threads <= 0) resolved.threads = max(1u, thread::hardware_concurrency());
+  BuildContext ctx{cache, resolved, options.split_spanning && canSplitExactly(cache), {resolved.threads - 1}, tree.memory.get(), {0}};
+
+  {
+    BuildTask task(ctx.memory);
+    if (!ctx.split) {
+      task.items.assign(triangle_indices.begin(), triangle_indices.end());
+    } else {
+      // Cada triângulo começa como um fragmento inteiro
+      task.items.reserve(triangle_indices.size());
+      task.fragments.reserve(triangle_indices.size());
+      for (int idx : triangle_indices) {
+        task.fragments.push_back(Fragment(idx, task.scratch.get()));
+        task.items.push_back((int)task.fragments.size() - 1);
+      }
+    }
+    tree.root = buildBSPNode(ctx, task, 0, 1, options.seed);
+    tree.arenas = move(task.arenas);
+  } // Rascunho da tarefa raiz liberado aqui
+
+  tree.stats = tree.memory->stats();
+  tree.spanning = ctx.spanning;
+  return tree;
+}
+
+// ======================================================================================================================= //
+
+BuildMemoryStats CountingResource::stats() const {
+  BuildMemoryStats stats;
+  stats.allocations = allocations_.load();
+  stats.peak_bytes = peak_.load();
+  stats.tree_bytes = bytes_.load();
+  return stats;
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+  void* p = pmr::new_delete_resource()->allocate(bytes, alignment);
+  allocations_++;
+  size_t in_use = bytes_ += bytes;
+  size_t peak = peak_.load();
+  while (in_use > peak && !peak_.compare_exchange_weak(peak, in_use)) {}
+  return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  bytes_ -= bytes;
+  pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+// ======================================================================================================================= //
+
+TreeStats computeTreeStats(const BSPNode* node) {
+  TreeStats stats;
+  if (!node) return stats;
+
+  TreeStats front = computeTreeStats(node->front);
+  TreeStats back = computeTreeStats(node->back);
+  bool leaf = node->triangle_index < 0;
+  stats.nodes = 1 + front.nodes + back.nodes;
+  stats.depth = 1 + max(front.depth, back.depth);
+  // Cada nó das subárvores fica um nível mais fundo abaixo deste
+  stats.depth_sum = 1 + front.depth_sum + front.nodes + back.depth_sum + back.nodes;
+  stats.leaves = leaf + front.leaves + back.leaves;
+  stats.max_bucket = max({leaf ? (int)node->bucket.size() : 0, front.max_bucket, back.max_bucket});
+  return stats;
+}
+
 // ======================================================================================================================= //
 
-bool segmentTriangleCoplanarIntersect( const Point3D& a, const Point3D& b, const Point3D& p0, const Point3D& p1, const Point3D& p2, const Point3D& normal) {
+FlatBSP flattenBSP(const BSPNode* root) {
+  FlatBSP tree;
+  if (!root) return tree;
+
+  // Pilha de (nó, posição do pai, é filho da frente); a frente é empilhada por último para sair logo após o pai
+  vector<tuple<const BSPNode*, uint32_t, bool>> stack;
+  stack.emplace_back(root, FLAT_NONE, true);
+
+  while (!stack.empty()) {
+    auto [node, parent, is_front] = stack.back();
+    stack.pop_back();
+
+    uint32_t index = (uint32_t)tree.nodes.size();
+    tree.boxes.push_back(node->box);
+    if (parent != FLAT_NONE) {
+      if (is_front) tree.nodes[parent].front = index;
+      else tree.nodes[parent].back = index;
+    }
+
+    if (node->triangle_index < 0) {
+      // Folha: o balde é copiado para o fim de leaf_triangles
+      FlatNode leaf;
+      leaf.nx = leaf.ny = leaf.nz = FLAT_LEAF;
+      leaf.triangle_index = (int)node->bucket.size();
+      leaf.d = (long long)tree.leaf_triangles.size();
+      leaf.front = leaf.back = FLAT_NONE;
+      tree.nodes.push_back(leaf);
+      tree.leaf_triangles.insert(tree.leaf_triangles.end(), node->bucket.begin(), node->bucket.end());
+      continue;
+    }
+
+    const Plane& plane = node->plane;
+    const Vec3L& n = plane.normal;
+    Int128 d = n.dot(plane.point);
+    FlatNode flat;
+    flat.triangle_index = node->triangle_index;
+
+    // Com |n| < 2^30 e |d| < 2^61, n · q - d cabe em 64 bits para qualquer |q| < COORD_LIMIT
+    const long long narrow = 1LL << 30;
+    bool fits = llabs(n.x) < narrow && llabs(n.y) < narrow && llabs(n.z) < narrow && d < ((Int128)1 << 61) && d > -((Int128)1 << 61);
+    if (fits) {
+      flat.nx = (int)n.x;
+      flat.ny = (int)n.y;
+      flat.nz = (int)n.z;
+      flat.d = (long long)d;
+    } else {
+      flat.nx = flat.ny = flat.nz = FLAT_WIDE;
+      flat.d = (long long)tree.wide_planes.size();
+      tree.wide_planes.push_back(WidePlane{{n.x, n.y, n.z}, 0, d});
+    }
+    flat.front = FLAT_NONE;
+    flat.back = FLAT_NONE;
+    tree.nodes.push_back(flat);
+
+    if (node->back) stack.emplace_back(node->back, index, false);
+    if (node->front) stack.emplace_back(node->front, index, true);
+  }
+
+  return tree;
+}
+
+// ======================================================================================================================= //
+
+bool segmentTriangleCoplanarIntersect( const Point3D& a, const Point3D& b, const Point3D& p0, const Point3D& p1, const Point3D& p2, const Vec3L& normal) {
 
   // Escolhe o plano de projeção com base no maior componente do vetor normal
   int axis = 0; // 0 = X, 1 = Y, 2 = Z
-  if (abs(normal.y) > abs(normal.x)) axis = 1;
-  if (abs(normal.z) > abs(normal.y) && abs(normal.z) > abs(normal.x)) axis = 2;
+  if (llabs(normal.y) > llabs(normal.x)) axis = 1;
+  if (llabs(normal.z) > llabs(normal.y) && llabs(normal.z) > llabs(normal.x)) axis = 2;
 
   // Função lambda para projetar um ponto em 2D
   auto project = [&](const Point3D& v) -> pair<int, int> {
@@ -114,8 +833,9 @@ bool segmentTriangleCoplanarIntersect( const Point3D& a, const Point3D& b, const
 // ======================================================================================================================= //
 
 int orientation(pair<int, int> p, pair<int, int> q, pair<int, int> r) {
-  int val = (q.second - p.second) * (r.first - q.first) -
-            (q.first - p.first) * (r.second - q.second);
+  // Diferenças cabem em int (|coord| < COORD_LIMIT) e cada produto em 62 bits: exato em 64 bits
+  long long val = (long long)(q.second - p.second) * (r.first - q.first) -
+                  (long long)(q.first - p.first) * (r.second - q.second);
   if (val == 0) return 0; // colinear
   return (val > 0) ? 1 : 2; // clockwise or counterclockwise
 }
@@ -148,8 +868,8 @@ bool segmentsIntersect2D(pair<int, int> p1, pair<int, int> q1, pair<int, int> p2
 
 bool pointInTriangle2D(pair<int, int> p, pair<int, int> a, pair<int, int> b, pair<int, int> c) {
   auto sign = [](pair<int, int> p1, pair<int, int> p2, pair<int, int> p3) {
-    return (p1.first - p3.first) * (p2.second - p3.second) -
-           (p2.first - p3.first) * (p1.second - p3.second);
+    return (long long)(p1.first - p3.first) * (p2.second - p3.second) -
+           (long long)(p2.first - p3.first) * (p1.second - p3.second);
   };
 
   bool b1 = sign(p, a, b) < 0;
@@ -169,7 +889,23 @@ bool segmentIntersectsPlane(const Point3D& a, const Point3D& b, const Plane& pla
 
 // ======================================================================================================================= //
 
-bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const Triangle& tri, const vector<Point3D>& points) {
+// A reta a + ab * t cruza o triângulo p0, p0 + e1, p0 + e2 (ab não paralelo ao plano) se os volumes orientados
+// de (a, b, pi, pj) para cada aresta não têm sinais opostos. Um volume nulo significa que a reta passa pela
+// aresta (ou vértice), o que conta como interseção. As somas u0 + ei valem pi - a e cabem em int.
+static inline bool lineCrossesTriangle(const Point3D& a, const Point3D& ab, const Point3D& p0, const Point3D& e1, const Point3D& e2) {
+  Point3D u0 = p0 - a;
+  Point3D u1 = u0 + e1;
+  Point3D u2 = u0 + e2;
+  int v01 = signOfDot(u0.cross(u1), ab);
+  int v12 = signOfDot(u1.cross(u2), ab);
+  int v20 = signOfDot(u2.cross(u0), ab);
+
+  bool has_positive = v01 > 0 || v12 > 0 || v20 > 0;
+  bool has_negative = v01 < 0 || v12 < 0 || v20 < 0;
+  return !(has_positive && has_negative);
+}
+
+bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const Triangle& tri, Span<Point3D> points) {
 
   // Obtem vértices do triângulo
   const Point3D& p0 = points[tri.a - 1];
@@ -177,94 +913,863 @@ bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const Triangl
   const Point3D& p2 = points[tri.c - 1];
 
   // Normal do plano do triângulo
-  Point3D normal = (p1 - p0).cross(p2 - p0);
+  Vec3L normal = (p1 - p0).cross(p2 - p0);
 
   // Verifica se o segmento é paralelo ao plano
   Point3D ab = b - a;
-  float denom = normal.dot(ab); // denominador
 
-  // Segmento é paralelo ao plano
-  if (denom == 0) {
+  // Segmento é paralelo ao plano (ou triângulo degenerado, com normal nula)
+  if (signOfDot(normal, ab) == 0) {
     // Verifica se o segmento está contido no plano
-    if (normal.dot(a - p0) != 0) return false;
+    if (signOfDot(normal, a - p0) != 0) return false;
 
     // Segmento está no plano: checar interseção 2D
     return segmentTriangleCoplanarIntersect(a, b, p0, p1, p2, normal);
   }
 
-  // Calcula o ponto de interseção com o plano
-  float t = normal.dot(p0 - a) / denom;
-
-  // Se t está fora do segmento [0,1], não intersecta.
-  // Equivalente a resolver normal · (a + ab * t - p0) = 0
-  if (t < 0 || t > 1) return false;
+  // Os extremos precisam estar em lados opostos do plano (ou sobre ele).
+  // Equivalente a 0 <= t <= 1 em normal · (a + ab * t - p0) = 0, sem dividir.
+  int sideA = signOfDot(normal, a - p0);
+  int sideB = signOfDot(normal, b - p0);
+  if (sideA * sideB > 0) return false;
 
-  // Define a interseção como ponto com coordenadas reais
-  double ix = a.x + (b.x - a.x) * t;
-  double iy = a.y + (b.y - a.y) * t;
-  double iz = a.z + (b.z - a.z) * t;
-  Point3D intersection = Point3D(static_cast<int>(round(ix)), static_cast<int>(round(iy)), static_cast<int>(round(iz)));
+  return lineCrossesTriangle(a, ab, p0, p1 - p0, p2 - p0);
+}
 
-  // Verifica se o ponto está dentro do triângulo usando coordenadas baricêntricas
-  Point3D v0 = p1 - p0;
-  Point3D v1 = p2 - p0;
-  Point3D v2 = intersection - p0;
+bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const TriangleCache& cache, int index) {
+  Vec3L normal = cache.normal(index);
+  Point3D ab = b - a;
 
-  float d00 = v0.dot(v0);
-  float d01 = v0.dot(v1);
-  float d02 = v0.dot(v2);
-  float d11 = v1.dot(v1);
-  float d12 = v1.dot(v2);
+  // Mesmos casos da versão acima, com normal e deslocamento já calculados
+  if (signOfDot(normal, ab) == 0) {
+    if (classifyPointToCachedPlane(cache, index, a) != 0) return false;
+    return segmentTriangleCoplanarIntersect(a, b, cache.vertex(index, 0), cache.vertex(index, 1), cache.vertex(index, 2), normal);
+  }
 
-  float denomBary = d00 * d11 - d01 * d01; // denominador baricêntrico
-  if (denomBary == 0) return false; // Triângulo degenerado, i.e, área zero
+  int sideA = classifyPointToCachedPlane(cache, index, a);
+  int sideB = classifyPointToCachedPlane(cache, index, b);
+  if (sideA * sideB > 0) return false;
 
-  float u = (d11 * d02 - d01 * d12) / denomBary;
-  float v = (d00 * d12 - d01 * d02) / denomBary;
-  
-  // Se u >= 0, v >= 0 e u + v <= 1, então o ponto está dentro ou sobre a borda do triângulo.
-  return (u >= 0) && (v >= 0) && (u + v <= 1);
+  return lineCrossesTriangle(a, ab, cache.vertex(index, 0), cache.edge1(index), cache.edge2(index));
 }
 
 
 // ======================================================================================================================= //
 
-void queryBSP(const BSPNode* node, const Point3D& a, const Point3D& b, const vector<Triangle>& triangles, const vector<Point3D>& points, set<int>& result) {
-  if (!node) return;
+bool segmentIntersectsBox(const Point3D& a, const Point3D& b, const NodeBox& box) {
+  int pa[3] = {a.x, a.y, a.z}, pb[3] = {b.x, b.y, b.z};
 
-  const Triangle& tri = triangles[node->triangle_index];
-  if (segmentIntersectsTriangle(a, b, tri, points)) {
+  // Rejeição rápida pela caixa do próprio segmento, que resolve a maioria dos casos com segmentos curtos
+  for (int k = 0; k < 3; ++k) {
+    if (max(pa[k], pb[k]) < box.lo[k] || min(pa[k], pb[k]) > box.hi[k]) return false;
+  }
+
+  // Intervalo [t0, t1] de a + (b - a) * t dentro da caixa, com t0 = n0 / d0 e t1 = n1 / d1 (d0, d1 > 0).
+  // Numeradores e denominadores ficam abaixo de 2^31, então as comparações cruzadas cabem em 64 bits.
+  long long n0 = 0, d0 = 1, n1 = 1, d1 = 1;
+  for (int k = 0; k < 3; ++k) {
+    long long delta = (long long)pb[k] - pa[k];
+    if (delta == 0) continue; // Já está dentro da faixa pela rejeição rápida
+    long long enter = (delta > 0 ? box.lo[k] : box.hi[k]) - (long long)pa[k];
+    long long leave = (delta > 0 ? box.hi[k] : box.lo[k]) - (long long)pa[k];
+    long long den = delta;
+    if (den < 0) {
+      enter = -enter;
+      leave = -leave;
+      den = -den;
+    }
+    if (enter * d0 > n0 * den) { n0 = enter; d0 = den; }
+    if (leave * d1 < n1 * den) { n1 = leave; d1 = den; }
+    if (n0 * d1 > n1 * d0) return false;
+  }
+  return true;
+}
+
+// ======================================================================================================================= //
+
+void queryBSP(const BSPNode* node, const Point3D& a, const Point3D& b, const TriangleCache& cache, HitSet& result) {
+  if (!node || !segmentIntersectsBox(a, b, node->box)) return;
+
+  if (node->triangle_index < 0) {
+    for (int tri : node->bucket) {
+      if (segmentIntersectsTriangle(a, b, cache, tri)) result.insert(tri + 1);
+    }
+    return;
+  }
+
+  if (segmentIntersectsTriangle(a, b, cache, node->triangle_index)) {
     result.insert(node->triangle_index + 1); // índice 1-based
   }
 
   int sideA = classifyPointToPlane(node->plane, a);
   int sideB = classifyPointToPlane(node->plane, b);
 
-  if (sideA >= 0 && sideB >= 0) queryBSP(node->front.get(), a, b, triangles, points, result);
-  else if (sideA <= 0 && sideB <= 0) queryBSP(node->back.get(), a, b, triangles, points, result);
-  else {
-    queryBSP(node->front.get(), a, b, triangles, points, result);
-    queryBSP(node->back.get(), a, b, triangles, points, result);
+  // Um extremo sobre o plano pode tocar triângulos dos dois lados, então visita ambos
+  if (sideA >= 0 || sideB >= 0) queryBSP(node->front, a, b, cache, result);
+  if (sideA <= 0 || sideB <= 0) queryBSP(node->back, a, b, cache, result);
+}
+
+// ======================================================================================================================= //
+
+// Lado de um ponto em relação ao plano de um nó linearizado: 1 (frente), -1 (trás), 0 (coplanar)
+static inline int classifyPointToFlatNode(const FlatBSPView& tree, const FlatNode& node, const Point3D& p) {
+  if (node.nx != FLAT_WIDE) {
+    long long s = (long long)node.nx * p.x + (long long)node.ny * p.y + (long long)node.nz * p.z - node.d;
+    return (s > 0) - (s < 0);
+  }
+  const WidePlane& plane = tree.wide_planes[node.d];
+  Int128 s = (Int128)plane.n[0] * p.x + (Int128)plane.n[1] * p.y + (Int128)plane.n[2] * p.z - plane.d;
+  return (s > 0) - (s < 0);
+}
+
+void QueryStats::merge(const QueryStats& other) {
+  segments += other.segments;
+  nodes_visited += other.nodes_visited;
+  for (int k = 0; k < HISTOGRAM_BINS; ++k) visit_histogram[k] += other.visit_histogram[k];
+  triangle_tests += other.triangle_tests;
+  hits += other.hits;
+  parallel_tests += other.parallel_tests;
+  coplanar_tests += other.coplanar_tests;
+  query_ms += other.query_ms;
+}
+
+// Os casos paralelo e coplanar são reclassificados aqui, o que só custa com --stats
+void QueryStats::countTest(const Point3D& a, const Point3D& b, const TriangleCache& cache, int index, bool hit) {
+  triangle_tests++;
+  hits += hit;
+  if (signOfDot(cache.normal(index), b - a) != 0) return;
+  parallel_tests++;
+  coplanar_tests += classifyPointToCachedPlane(cache, index, a) == 0;
+}
+
+void QueryStats::countPacketTests(const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, size_t row, size_t count, size_t found) {
+  for (size_t r = row; r < row + count; ++r) countTest(a, b, cache, packets.ids[r], false);
+  hits += found;
+}
+
+void queryFlatBSP(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, HitSet& result, QueryStats* stats) {
+  if (tree.nodes.empty()) return;
+
+  vector<uint32_t> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+
+  // Acertos de um trecho do balde; baldes maiores são testados em vários trechos
+  const size_t hits_size = 64;
+  int hits[hits_size];
+
+  while (!stack.empty()) {
+    uint32_t index = stack.back();
+    stack.pop_back();
+    if (!segmentIntersectsBox(a, b, tree.boxes[index])) continue;
+    if (stats) stats->nodes_visited++;
+
+    const FlatNode& node = tree.nodes[index];
+    if (node.nx == FLAT_LEAF) {
+      size_t end = (size_t)node.d + node.triangle_index;
+      for (size_t row = node.d; row < end; row += hits_size) {
+        size_t found = intersectPacket(a, b, packets, cache, row, min(hits_size, end - row), hits);
+        if (stats) stats->countPacketTests(a, b, cache, packets, row, min(hits_size, end - row), found);
+        for (size_t k = 0; k < found; ++k) result.insert(hits[k] + 1); // índice 1-based
+      }
+      continue;
+    }
+
+    bool hit = segmentIntersectsTriangle(a, b, cache, node.triangle_index);
+    if (stats) stats->countTest(a, b, cache, node.triangle_index, hit);
+    if (hit) result.insert(node.triangle_index + 1); // índice 1-based
+
+    int sideA = classifyPointToFlatNode(tree, node, a);
+    int sideB = classifyPointToFlatNode(tree, node, b);
+
+    // Mesma regra de queryBSP; a frente é empilhada por último para ser visitada primeiro
+    if ((sideA <= 0 || sideB <= 0) && node.back != FLAT_NONE) stack.push_back(node.back);
+    if ((sideA >= 0 || sideB >= 0) && node.front != FLAT_NONE) stack.push_back(node.front);
+  }
+}
+
+// Segmentos de um pacote do modo coerente; a máscara de ativos cabe em 32 bits
+const size_t SEGMENT_PACKET = 16;
+
+// Percurso de um pacote de segmentos vizinhos, com as mesmas regras de queryFlatBSP: cada nó é lido uma vez para o
+// pacote inteiro e uma máscara diz quais segmentos ainda passam por ele. lanes[k] recebe os triângulos (0-based,
+// possivelmente repetidos) intersectados por segments[k]. Com stats, cada segmento do pacote também é registrado
+// com addSegment.
+static void queryFlatBSPPacket(const FlatBSPView& tree, const Segment* const* segments, size_t count, const TriangleCache& cache, const TrianglePackets& packets, vector<int>* lanes, QueryStats* stats) {
+  if (tree.nodes.empty() || count == 0) return;
+
+  size_t visits[SEGMENT_PACKET] = {};        // Nós visitados por segmento, só com stats
+
+  vector<pair<uint32_t, uint32_t>> stack;    // (nó, máscara dos segmentos que chegam a ele)
+  stack.reserve(64);
+  stack.emplace_back(0, (uint32_t)((1ULL << count) - 1));
+
+  const size_t hits_size = 64;
+  int hits[hits_size];
+
+  while (!stack.empty()) {
+    auto [index, incoming] = stack.back();
+    stack.pop_back();
+
+    uint32_t mask = 0;
+    const NodeBox& box = tree.boxes[index];
+    for (uint32_t m = incoming; m; m &= m - 1) {
+      int k = __builtin_ctz(m);
+      if (segmentIntersectsBox(segments[k]->p1, segments[k]->p2, box)) mask |= 1u << k;
+    }
+    if (!mask) continue;
+    if (stats) {
+      for (uint32_t m = mask; m; m &= m - 1) visits[__builtin_ctz(m)]++;
+    }
+
+    const FlatNode& node = tree.nodes[index];
+    if (node.nx == FLAT_LEAF) {
+      size_t end = (size_t)node.d + node.triangle_index;
+      for (uint32_t m = mask; m; m &= m - 1) {
+        int k = __builtin_ctz(m);
+        for (size_t row = node.d; row < end; row += hits_size) {
+          size_t found = intersectPacket(segments[k]->p1, segments[k]->p2, packets, cache, row, min(hits_size, end - row), hits);
+          if (stats) stats->countPacketTests(segments[k]->p1, segments[k]->p2, cache, packets, row, min(hits_size, end - row), found);
+          lanes[k].insert(lanes[k].end(), hits, hits + found);
+        }
+      }
+      continue;
+    }
+
+    uint32_t front = 0, back = 0;
+    for (uint32_t m = mask; m; m &= m - 1) {
+      int k = __builtin_ctz(m);
+      const Point3D& a = segments[k]->p1;
+      const Point3D& b = segments[k]->p2;
+      bool hit = segmentIntersectsTriangle(a, b, cache, node.triangle_index);
+      if (stats) stats->countTest(a, b, cache, node.triangle_index, hit);
+      if (hit) lanes[k].push_back(node.triangle_index);
+      int sideA = classifyPointToFlatNode(tree, node, a);
+      int sideB = classifyPointToFlatNode(tree, node, b);
+      if (sideA <= 0 || sideB <= 0) back |= 1u << k;
+      if (sideA >= 0 || sideB >= 0) front |= 1u << k;
+    }
+    if (back && node.back != FLAT_NONE) stack.emplace_back(node.back, back);
+    if (front && node.front != FLAT_NONE) stack.emplace_back(node.front, front);
+  }
+
+  if (stats) {
+    for (size_t k = 0; k < count; ++k) {
+      stats->nodes_visited += visits[k];
+      stats->addSegment(visits[k]);
+    }
+  }
+}
+
+// ======================================================================================================================= //
+
+// Extremo do intervalo paramétrico de a + (b - a) t: a raiz t = p / (p - q) de uma função linear que vale p em a
+// e q em b. t = 0 é (0, 1) e t = 1 é (1, 0); os demais são os valores n · a - d e n · b - d de um plano divisor,
+// que nos nós compactos ficam abaixo de 2^63.
+struct ClipBound {
+  long long p, q;
+};
+
+// Lado do ponto do segmento em t em relação ao plano que vale sa em a e sb em b: o plano vale
+// (p sb - sa q) / (p - q) ali. Cada produto fica abaixo de 2^126, então a conta é exata em 128 bits.
+static inline int sideAtBound(long long sa, long long sb, const ClipBound& t) {
+  Int128 s = (Int128)t.p * sb - (Int128)sa * t.q;
+  int sign = (s > 0) - (s < 0);
+  return t.p > t.q ? sign : -sign;
+}
+
+// Nó a visitar com o pedaço [t0, t1] do segmento que cai na sua célula
+struct ClipEntry {
+  uint32_t node;
+  ClipBound t0, t1;
+};
+
+// Percurso com recorte. visit recebe o índice (0-based) de cada triângulo intersectado e devolve true para parar.
+template <typename Visit>
+static void traverseClipped(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, QueryStats* stats, Visit visit) {
+  if (tree.nodes.empty()) return;
+
+  vector<ClipEntry> stack;
+  stack.reserve(64);
+  stack.push_back(ClipEntry{0, {0, 1}, {1, 0}});
+
+  const size_t hits_size = 64;
+  int hits[hits_size];
+
+  while (!stack.empty()) {
+    ClipEntry entry = stack.back();
+    stack.pop_back();
+    if (!segmentIntersectsBox(a, b, tree.boxes[entry.node])) continue;
+    if (stats) stats->nodes_visited++;
+
+    // O teste de triângulo continua sendo feito com o segmento inteiro; o recorte só escolhe os filhos
+    const FlatNode& node = tree.nodes[entry.node];
+    if (node.nx == FLAT_LEAF) {
+      size_t end = (size_t)node.d + node.triangle_index;
+      for (size_t row = node.d; row < end; row += hits_size) {
+        size_t found = intersectPacket(a, b, packets, cache, row, min(hits_size, end - row), hits);
+        if (stats) stats->countPacketTests(a, b, cache, packets, row, min(hits_size, end - row), found);
+        for (size_t k = 0; k < found; ++k) {
+          if (visit(hits[k])) return;
+        }
+      }
+      continue;
+    }
+
+    bool hit = segmentIntersectsTriangle(a, b, cache, node.triangle_index);
+    if (stats) stats->countTest(a, b, cache, node.triangle_index, hit);
+    if (hit && visit(node.triangle_index)) return;
+
+    ClipEntry front{node.front, entry.t0, entry.t1};
+    ClipEntry back{node.back, entry.t0, entry.t1};
+    int side0 = 0, side1 = 0;
+
+    // Planos largos não cabem na conta de 128 bits: os dois filhos recebem o intervalo inteiro
+    if (node.nx != FLAT_WIDE) {
+      long long sa = (long long)node.nx * a.x + (long long)node.ny * a.y + (long long)node.nz * a.z - node.d;
+      long long sb = (long long)node.nx * b.x + (long long)node.ny * b.y + (long long)node.nz * b.z - node.d;
+      side0 = sideAtBound(sa, sb, entry.t0);
+      side1 = sideAtBound(sa, sb, entry.t1);
+
+      // O pedaço cruza o plano: cada filho fica com a parte do seu lado
+      if (side0 * side1 < 0) {
+        ClipBound cut{sa, sb};
+        if (side0 > 0) front.t1 = back.t0 = cut;
+        else back.t1 = front.t0 = cut;
+      }
+    }
+
+    // Mesma regra de queryFlatBSP sobre os extremos do pedaço; o filho do lado de t0 é visitado primeiro
+    bool to_front = (side0 >= 0 || side1 >= 0) && node.front != FLAT_NONE;
+    bool to_back = (side0 <= 0 || side1 <= 0) && node.back != FLAT_NONE;
+    if (side0 < 0) {
+      if (to_front) stack.push_back(front);
+      if (to_back) stack.push_back(back);
+    } else {
+      if (to_back) stack.push_back(back);
+      if (to_front) stack.push_back(front);
+    }
   }
 }
 
+void queryFlatBSPClipped(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, HitSet& result, QueryStats* stats) {
+  traverseClipped(tree, a, b, cache, packets, stats, [&](int tri) {
+    result.insert(tri + 1); // índice 1-based
+    return false;
+  });
+}
+
+int queryFlatBSPAnyHit(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, QueryStats* stats) {
+  int hit = 0;
+  traverseClipped(tree, a, b, cache, packets, stats, [&](int tri) {
+    hit = tri + 1; // índice 1-based
+    return true;
+  });
+  return hit;
+}
+
 // ======================================================================================================================= //
 
-vector<vector<int>> processSegments(const BSPData& data) {
+QueryResults processSegments(const BSPDataView& data) {
   vector<int> all_indices(data.triangles.size());
   for (int i = 0; i < (int)data.triangles.size(); ++i) all_indices[i] = i;
 
-  unique_ptr<BSPNode> bsp_tree = buildBSP(data.triangles, data.points, all_indices);
+  TriangleCache cache = buildTriangleCache(data.triangles, data.points);
+  BSPTree bsp_tree = buildBSP(cache, all_indices);
+  return processSegments(data, cache, flattenBSP(bsp_tree.get()), QueryOptions());
+}
+
+QueryResults processSegments(const BSPDataView& data, const BSPNode* tree) {
+  return processSegments(data, flattenBSP(tree));
+}
+
+QueryResults processSegments(const BSPDataView& data, const FlatBSPView& tree, int threads) {
+  QueryOptions options;
+  options.threads = threads;
+  return processSegments(data, buildTriangleCache(data.triangles, data.points), tree, options);
+}
+
+QueryResults processSegments(const BSPDataView& data, const TriangleCache& cache, const FlatBSPView& tree, const QueryOptions& options) {
+  QuerySession session(cache, tree, options);
+  QueryResults results;
+  session.run(data.segments, results);
+  return results;
+}
+
+// ======================================================================================================================= //
+
+QuerySession::QuerySession(const TriangleCache& cache, const FlatBSPView& tree, const QueryOptions& options)
+  : cache_(cache), tree_(tree), options_(options) {
+  // Os baldes das folhas são convertidos uma vez e compartilhados, só para leitura, entre as threads
+  own_packets_ = make_unique<TrianglePackets>(buildTrianglePackets(cache, tree.leaf_triangles, options.simd));
+  packets_ = own_packets_.get();
+  initThreads();
+}
+
+QuerySession::QuerySession(const TriangleCache& cache, const SpatialIndex& index, const QueryOptions& options)
+  : cache_(cache), options_(options) {
+  if (const BSPIndex* bsp = index.asBSP()) {
+    tree_ = bsp->tree();
+    packets_ = &bsp->packets();
+  } else {
+    index_ = &index;
+  }
+  initThreads();
+}
+
+void QuerySession::initThreads() {
+  int threads = options_.threads;
+  if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+  states_.resize(threads);
+  for (ThreadState& state : states_) state.intersected = HitSet(cache_.size());
+}
+
+QuerySession::~QuerySession() = default;
+
+// Espalha os 21 bits menos significativos de v de três em três, para intercalar as coordenadas no código de Morton
+static uint64_t spreadBits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffULL;
+  v = (v | v << 16) & 0x1f0000ff0000ffULL;
+  v = (v | v << 8) & 0x100f00f00f00f00fULL;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+  v = (v | v << 2) & 0x1249249249249249ULL;
+  return v;
+}
+
+uint64_t mortonCode(const long long p[3], const long long lo[3], const long long hi[3]) {
+  const long long levels = (1 << 21) - 1;
+  uint64_t code = 0;
+  for (int k = 0; k < 3; ++k) {
+    // (p - lo) < 2^34, então o produto fica abaixo de 2^55
+    uint64_t q = (uint64_t)((p[k] - lo[k]) * levels / max(hi[k] - lo[k], 1LL));
+    code |= spreadBits(q) << k;
+  }
+  return code;
+}
+
+// Ordena os segmentos pelo código de Morton do ponto médio, dentro da caixa dos pontos médios do lote. O ponto
+// médio é guardado dobrado (p1 + p2), que com |c| < 2^30 cabe em 32 bits.
+void QuerySession::sortByMorton(Span<Segment> segments) {
+  long long lo[3] = {LLONG_MAX, LLONG_MAX, LLONG_MAX}, hi[3] = {LLONG_MIN, LLONG_MIN, LLONG_MIN};
+  for (const Segment& seg : segments) {
+    long long mid[3] = {(long long)seg.p1.x + seg.p2.x, (long long)seg.p1.y + seg.p2.y, (long long)seg.p1.z + seg.p2.z};
+    for (int k = 0; k < 3; ++k) {
+      lo[k] = min(lo[k], mid[k]);
+      hi[k] = max(hi[k], mid[k]);
+    }
+  }
+
+  order_.resize(segments.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const Segment& seg = segments[i];
+    long long mid[3] = {(long long)seg.p1.x + seg.p2.x, (long long)seg.p1.y + seg.p2.y, (long long)seg.p1.z + seg.p2.z};
+    order_[i] = {mortonCode(mid, lo, hi), (uint32_t)i};
+  }
+  sort(order_.begin(), order_.end());
+}
+
+void QuerySession::run(Span<Segment> segments, QueryResults& results) {
+  chrono::steady_clock::time_point start;
+  if (options_.stats) start = chrono::steady_clock::now();
+  runBatch(segments, results);
+
+  // Cache reordenado (CompactMesh): as linhas voltam a ser os triângulos da entrada, de novo em ordem crescente
+  if (!cache_.original.empty()) {
+    for (int& id : results.ids) id = cache_.original[id - 1] + 1;
+    for (size_t i = 0; i < results.size(); ++i) {
+      sort(results.ids.begin() + results.offsets[i], results.ids.begin() + results.offsets[i + 1]);
+    }
+  }
+  if (options_.stats) stats_.query_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void QuerySession::runBatch(Span<Segment> segments, QueryResults& results) {
+  size_t count = segments.size();
+
+  // No modo coerente os segmentos são processados na ordem de order_ e os resultados voltam à ordem da entrada no fim
+  bool coherent = options_.coherent;
+  bool packet_walk = coherent && !options_.clip && !options_.any_hit && !index_;
+  if (coherent) sortByMorton(segments);
+  auto segmentAt = [&](size_t i) -> const Segment& { return coherent ? segments[order_[i].second] : segments[i]; };
+
+  // Blocos pequenos o bastante para equilibrar a carga entre threads, grandes o bastante para
+  // que o contador atômico não vire gargalo
+  const size_t chunk = 256;
+  size_t chunks = (count + chunk - 1) / chunk;
+  int threads = (int)min(states_.size(), max(chunks, (size_t)1));
+  atomic<size_t> next_chunk(0);
+
+  // Cada thread acumula os resultados dos seus blocos em um buffer próprio (contagens e índices);
+  // chunk_start_ guarda onde cada bloco começa nesse buffer para a junção no fim
+  chunk_thread_.resize(chunks);
+  chunk_start_.resize(chunks);
+
+  auto worker = [&](int t) {
+    ThreadState& out = states_[t];
+    HitSet& intersected = out.intersected;   // Reaproveitado entre segmentos e lotes
+    out.counts.clear();
+    out.ids.clear();
+    out.stats = QueryStats();
+    QueryStats* stats = options_.stats ? &out.stats : nullptr;
+    if (packet_walk) out.lanes.resize(SEGMENT_PACKET);
+    for (size_t c = next_chunk++; c < chunks; c = next_chunk++) {
+      chunk_thread_[c] = t;
+      chunk_start_[c] = {out.counts.size(), out.ids.size()};
+      size_t end = min(count, (c + 1) * chunk);
+
+      if (packet_walk) {
+        // Pacotes de segmentos consecutivos na curva; as repetições de triângulos SPANNING saem na ordenação
+        for (size_t i = c * chunk; i < end; i += SEGMENT_PACKET) {
+          size_t lanes = min(SEGMENT_PACKET, end - i);
+          const Segment* group[SEGMENT_PACKET];
+          for (size_t k = 0; k < lanes; ++k) {
+            group[k] = &segmentAt(i + k);
+            out.lanes[k].clear();
+          }
+          queryFlatBSPPacket(tree_, group, lanes, cache_, *packets_, out.lanes.data(), stats);
+          for (size_t k = 0; k < lanes; ++k) {
+            vector<int>& hits = out.lanes[k];
+            sort(hits.begin(), hits.end());
+            hits.erase(unique(hits.begin(), hits.end()), hits.end());
+            for (int tri : hits) out.ids.push_back(tri + 1); // índice 1-based
+            out.counts.push_back((uint32_t)hits.size());
+          }
+        }
+        continue;
+      }
+
+      for (size_t i = c * chunk; i < end; ++i) {
+        const Segment& seg = segmentAt(i);
+        size_t visited = stats ? stats->nodes_visited : 0;
+        if (options_.any_hit && !index_) {
+          int hit = queryFlatBSPAnyHit(tree_, seg.p1, seg.p2, cache_, *packets_, stats);
+          if (stats) stats->addSegment(stats->nodes_visited - visited);
+          if (hit) out.ids.push_back(hit);
+          out.counts.push_back(hit ? 1 : 0);
+          continue;
+        }
+        intersected.clear();
+        if (index_) index_->query(seg.p1, seg.p2, intersected, stats);
+        else if (options_.clip) queryFlatBSPClipped(tree_, seg.p1, seg.p2, cache_, *packets_, intersected, stats);
+        else queryFlatBSP(tree_, seg.p1, seg.p2, cache_, *packets_, intersected, stats);
+        if (stats) stats->addSegment(stats->nodes_visited - visited);
+        sort(intersected.hits.begin(), intersected.hits.end());
+        size_t found = options_.any_hit ? min(intersected.hits.size(), (size_t)1) : intersected.hits.size();
+        out.ids.insert(out.ids.end(), intersected.hits.begin(), intersected.hits.begin() + found);
+        out.counts.push_back((uint32_t)found);
+      }
+    }
+  };
+
+  vector<thread> pool;
+  for (int t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+  worker(0);
+  for (thread& th : pool) th.join();
+
+  // Só as threads usadas neste lote zeraram os seus contadores
+  if (options_.stats) {
+    for (int t = 0; t < threads; ++t) stats_.merge(states_[t].stats);
+  }
+
+  results.offsets.assign(1, 0);
+  results.offsets.reserve(count + 1);
+  results.ids.clear();
+
+  if (coherent) {
+    // Localiza cada segmento no buffer da sua thread e copia os resultados na ordem da entrada
+    placement_.resize(count);
+    for (size_t c = 0; c < chunks; ++c) {
+      const ThreadState& out = states_[chunk_thread_[c]];
+      size_t start = chunk_start_[c].second;
+      for (size_t i = c * chunk, k = chunk_start_[c].first; i < min(count, (c + 1) * chunk); ++i, ++k) {
+        placement_[order_[i].second] = Placement{(uint32_t)chunk_thread_[c], out.counts[k], start};
+        start += out.counts[k];
+      }
+    }
+    for (const Placement& p : placement_) results.offsets.push_back(results.offsets.back() + p.count);
+    results.ids.resize(results.offsets.back());
+    for (size_t i = 0; i < count; ++i) {
+      const Placement& p = placement_[i];
+      const vector<int>& ids = states_[p.thread].ids;
+      copy(ids.begin() + p.start, ids.begin() + p.start + p.count, results.ids.begin() + results.offsets[i]);
+    }
+    return;
+  }
+
+  // Junta os blocos na ordem dos segmentos
+  if (threads == 1) {
+    // Uma thread processa os blocos em ordem: o buffer já é a saída, e o antigo vira o próximo buffer
+    results.ids.swap(states_[0].ids);
+    for (uint32_t n : states_[0].counts) results.offsets.push_back(results.offsets.back() + n);
+    return;
+  }
+
+  size_t total = 0;
+  for (int t = 0; t < threads; ++t) total += states_[t].ids.size();
+  results.ids.reserve(total);
+  for (size_t c = 0; c < chunks; ++c) {
+    const ThreadState& out = states_[chunk_thread_[c]];
+    size_t segments_in_chunk = min(count, (c + 1) * chunk) - c * chunk;
+    size_t ids_begin = chunk_start_[c].second;
+    size_t ids_count = 0;
+    for (size_t k = 0; k < segments_in_chunk; ++k) {
+      uint32_t n = out.counts[chunk_start_[c].first + k];
+      results.offsets.push_back(results.offsets.back() + n);
+      ids_count += n;
+    }
+    results.ids.insert(results.ids.end(), out.ids.begin() + ids_begin, out.ids.begin() + ids_begin + ids_count);
+  }
+}
+
+// ======================================================================================================================= //
+
+// A caixa inner está contida em outer
+static bool boxContains(const NodeBox& outer, const NodeBox& inner) {
+  for (int k = 0; k < 3; ++k) {
+    if (inner.lo[k] < outer.lo[k] || inner.hi[k] > outer.hi[k]) return false;
+  }
+  return true;
+}
+
+DynamicBSP::DynamicBSP(Span<Triangle> triangles, Span<Point3D> points, const BuildOptions& options, const UpdateOptions& update)
+  : cache_(buildTriangleCache(triangles, points)), options_(options), update_(update), alive_(triangles.size(), 1) {
+  if (triangles.empty()) return;
+  vector<int> all_indices(triangles.size());
+  for (int i = 0; i < (int)triangles.size(); ++i) all_indices[i] = i;
+  BSPTree built = buildBSP(cache_, move(all_indices), options_);
+  root_ = adopt(built.root);
+}
+
+int DynamicBSP::insert(const Point3D& a, const Point3D& b, const Point3D& c) {
+  int tri = (int)cache_.size();
+  appendTriangle(cache_, a, b, c);
+  alive_.push_back(1);
+
+  root_ = insertInto(root_, tri);
+  refreshPath(tri);
+  return tri + 1;
+}
+
+bool DynamicBSP::remove(int index) {
+  if (!contains(index)) return false;
+  int tri = index - 1;
+  alive_[tri] = 0;
+
+  removeFrom(root_, tri, triangleBox(cache_, tri));
+  refreshPath(tri);
+  return true;
+}
+
+void DynamicBSP::query(const Point3D& a, const Point3D& b, HitSet& result) const {
+  queryBSP(root_, a, b, cache_, result);
+
+  // Tombstones continuam na árvore até a subárvore ser reconstruída
+  result.hits.erase(remove_if(result.hits.begin(), result.hits.end(), [&](int id) { return !alive_[id - 1]; }), result.hits.end());
+}
+
+QueryResults DynamicBSP::query(Span<Segment> segments) const {
+  QueryResults results;
+  results.offsets.reserve(segments.size() + 1);
+  HitSet intersected(cache_.size());
+  for (const Segment& seg : segments) {
+    intersected.clear();
+    query(seg.p1, seg.p2, intersected);
+    sort(intersected.hits.begin(), intersected.hits.end());
+    results.ids.insert(results.ids.end(), intersected.hits.begin(), intersected.hits.end());
+    results.offsets.push_back(results.ids.size());
+  }
+  return results;
+}
+
+// ======================================================================================================================= //
+
+// Desce tri pelos planos até um filho vazio ou uma folha. Devolve a raiz da subárvore, que só muda quando ela
+// era vazia.
+BSPNode* DynamicBSP::insertInto(BSPNode* node, int tri) {
+  if (!node) return newNode(tri);
+
+  int added = 0;
+  if (node->triangle_index < 0) {
+    Span<int> old = node->bucket;
+    node->bucket = newBucket(old.data(), old.size(), tri);
+    pool_.deallocate(const_cast<int*>(old.data()), old.size() * sizeof(int), alignof(int));
+    added = 1;
+  } else {
+    // Mesma regra da construção: COPLANAR fica na frente e SPANNING é duplicado nos dois lados
+    Position side = classifyTriangle(node->plane, cache_, tri);
+    if (side != Position::BACK) {
+      int before = node->front ? node->front->references : 0;
+      node->front = insertInto(node->front, tri);
+      added += node->front->references - before;
+    }
+    if (side == Position::BACK || side == Position::SPANNING) {
+      int before = node->back ? node->back->references : 0;
+      node->back = insertInto(node->back, tri);
+      added += node->back->references - before;
+    }
+  }
+
+  node->references += added;
+  node->inserted += added;
+  growBox(node->box, triangleBox(cache_, tri));
+  return node;
+}
+
+// Marca as entradas de tri na subárvore como removidas e devolve quantas eram. O caminho é o mesmo da inserção,
+// e subárvores cuja caixa não contém a do triângulo são puladas.
+int DynamicBSP::removeFrom(BSPNode* node, int tri, const NodeBox& box) {
+  if (!node || !boxContains(node->box, box)) return 0;
+
+  int found = 0;
+  if (node->triangle_index < 0) {
+    found = binary_search(node->bucket.begin(), node->bucket.end(), tri) ? 1 : 0;
+  } else if (node->triangle_index == tri) {
+    found = 1; // O divisor não é repassado aos filhos
+  } else {
+    Position side = classifyTriangle(node->plane, cache_, tri);
+    if (side != Position::BACK) found += removeFrom(node->front, tri, box);
+    if (side == Position::BACK || side == Position::SPANNING) found += removeFrom(node->back, tri, box);
+  }
+  node->dead += found;
+  return found;
+}
+
+// Reconstrói o que passou dos limites no caminho de tri, depois da inserção ou remoção
+void DynamicBSP::refreshPath(int tri) {
+  forks_.clear();
+  if (!markForks(root_, tri)) return;
+  Delta delta;
+  root_ = refresh(root_, tri, delta);
+}
+
+// Informa se o caminho de tri a partir de node tem uma subárvore vencida, e marca em forks_ os nós SPANNING com
+// subárvores vencidas dos dois lados. Um SPANNING perto da raiz se espalha por centenas de caminhos, e
+// reconstruir cada subárvore vencida deles em separado custaria muito mais que reconstruir a bifurcação.
+bool DynamicBSP::markForks(const BSPNode* node, int tri) {
+  if (!node) return false;
+  if (stale(node)) return true;
+  if (node->triangle_index < 0 || node->triangle_index == tri) return false;
+
+  Position side = classifyTriangle(node->plane, cache_, tri);
+  bool front = side != Position::BACK && markForks(node->front, tri);
+  bool back = (side == Position::BACK || side == Position::SPANNING) && markForks(node->back, tri);
+  if (front && back) forks_.push_back(node);
+  return front || back;
+}
+
+// Percorre de cima para baixo o caminho de tri e reconstrói a primeira subárvore que passou de um limite ou foi
+// marcada como bifurcação. delta recebe a variação dos contadores, que os ancestrais somam aos seus.
+BSPNode* DynamicBSP::refresh(BSPNode* node, int tri, Delta& delta) {
+  if (!node) return nullptr;
+  if (stale(node) || find(forks_.begin(), forks_.end(), node) != forks_.end()) return rebuild(node, delta);
+  if (node->triangle_index < 0 || node->triangle_index == tri) return node;
+
+  Delta below;
+  Position side = classifyTriangle(node->plane, cache_, tri);
+  if (side != Position::BACK) node->front = refresh(node->front, tri, below);
+  if (side == Position::BACK || side == Position::SPANNING) node->back = refresh(node->back, tri, below);
 
-  vector<vector<int>> output;
+  node->references += below.references;
+  node->dead += below.dead;
+  node->inserted += below.inserted;
+  delta.references += below.references;
+  delta.dead += below.dead;
+  delta.inserted += below.inserted;
+  return node;
+}
+
+bool DynamicBSP::stale(const BSPNode* node) const {
+  if (node->references < update_.min_rebuild) return false;
+  int built = node->references - node->inserted;
+  return node->dead > update_.max_dead_ratio * node->references || node->inserted > update_.max_insert_ratio * built;
+}
 
-  for (const auto& seg : data.segments) {
-    set<int> intersected;
-    queryBSP(bsp_tree.get(), seg.p1, seg.p2, data.triangles, data.points, intersected);
-    vector<int> list(intersected.begin(), intersected.end());
-    sort(list.begin(), list.end());
-    output.push_back(list);
+// Troca a subárvore por uma construída do zero sobre os seus triângulos vivos
+BSPNode* DynamicBSP::rebuild(BSPNode* node, Delta& delta) {
+  vector<int> ids;
+  collect(node, ids);
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  stats_.rebuilds++;
+  stats_.rebuilt_triangles += ids.size();
+
+  BSPNode* fresh = nullptr;
+  if (!ids.empty()) {
+    BSPTree built = buildBSP(cache_, move(ids), options_);
+    fresh = adopt(built.root);
   }
 
-  return output;
+  delta.references += (fresh ? fresh->references : 0) - node->references;
+  delta.dead -= node->dead;
+  delta.inserted -= node->inserted;
+  release(node);
+  return fresh;
+}
+
+// ======================================================================================================================= //
+
+// Nó novo para um triângulo que chegou a um filho vazio: folha com balde se a árvore usa folhas
+BSPNode* DynamicBSP::newNode(int tri) {
+  BSPNode* node = new (pool_.allocate(sizeof(BSPNode), alignof(BSPNode))) BSPNode();
+  if (options_.leaf_size > 0) {
+    node->bucket = newBucket(nullptr, 0, tri);
+  } else {
+    node->triangle_index = tri;
+    node->plane = cache_.plane(tri);
+  }
+  node->box = triangleBox(cache_, tri);
+  node->references = 1;
+  node->inserted = 1;
+  return node;
+}
+
+// Copia para o pool uma subárvore recém-construída, contando as entradas de cada nó
+BSPNode* DynamicBSP::adopt(const BSPNode* source) {
+  if (!source) return nullptr;
+  BSPNode* node = new (pool_.allocate(sizeof(BSPNode), alignof(BSPNode))) BSPNode(*source);
+  if (!source->bucket.empty()) node->bucket = newBucket(source->bucket.data(), source->bucket.size(), -1);
+  node->front = adopt(source->front);
+  node->back = adopt(source->back);
+
+  node->references = (node->triangle_index >= 0 ? 1 : 0) + (int)node->bucket.size();
+  if (node->front) node->references += node->front->references;
+  if (node->back) node->references += node->back->references;
+  node->dead = 0;
+  node->inserted = 0;
+  return node;
+}
+
+// Balde no pool com ids[0..count) mais extra (se não for -1), em ordem crescente
+Span<int> DynamicBSP::newBucket(const int* ids, size_t count, int extra) {
+  size_t size = count + (extra >= 0 ? 1 : 0);
+  int* bucket = static_cast<int*>(pool_.allocate(size * sizeof(int), alignof(int)));
+  if (extra < 0) {
+    copy(ids, ids + count, bucket);
+  } else {
+    const int* pos = lower_bound(ids, ids + count, extra);
+    int* out = copy(ids, pos, bucket);
+    *out++ = extra;
+    copy(pos, ids + count, out);
+  }
+  return Span<int>(bucket, size);
+}
+
+void DynamicBSP::release(BSPNode* node) {
+  if (!node) return;
+  release(node->front);
+  release(node->back);
+  if (!node->bucket.empty()) pool_.deallocate(const_cast<int*>(node->bucket.data()), node->bucket.size() * sizeof(int), alignof(int));
+  pool_.deallocate(node, sizeof(BSPNode), alignof(BSPNode));
+}
+
+// Triângulos vivos da subárvore, com repetições
+void DynamicBSP::collect(const BSPNode* node, vector<int>& ids) const {
+  if (!node) return;
+  if (node->triangle_index >= 0 && alive_[node->triangle_index]) ids.push_back(node->triangle_index);
+  for (int tri : node->bucket) {
+    if (alive_[tri]) ids.push_back(tri);
+  }
+  collect(node->front, ids);
+  collect(node->back, ids);
 }
@@ -15,15 +15,57 @@
 #include <iostream>
 #include <vector>
 #include <memory>
-#include <set>
+#include <memory_resource>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <string>
 
 using namespace std;
 
 // ======================================================================================================================= //
 
+/**
+ * Visão somente leitura de um trecho contíguo de memória (versão mínima do std::span, que não existe em C++17).
+ * Converte-se implicitamente a partir de um vector, então as rotinas que recebem Span funcionam tanto sobre os
+ * vetores lidos da entrada quanto sobre arrays mapeados diretamente de um arquivo binário.
+ */
+template <typename T>
+struct Span {
+  const T* ptr = nullptr;
+  size_t count = 0;
+
+  Span() = default;
+  Span(const T* ptr, size_t count) : ptr(ptr), count(count) {}
+  Span(const vector<T>& v) : ptr(v.data()), count(v.size()) {}
+
+  const T& operator[](size_t i) const { return ptr[i]; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const T* data() const { return ptr; }
+  const T* begin() const { return ptr; }
+  const T* end() const { return ptr + count; }
+};
+
+// ======================================================================================================================= //
+
+typedef __int128 Int128;
+
+/**
+ * Limite (exclusivo) do módulo das coordenadas aceitas na entrada. Abaixo dele as diferenças entre
+ * coordenadas cabem em int, os produtos vetoriais em 64 bits e os testes de lado em 128 bits, então
+ * todos os predicados geométricos são exatos.
+ */
+const int COORD_LIMIT = 1 << 30;
+
+struct Vec3L;
+
+// ======================================================================================================================= //
+
 /**
  * Vetor ou ponto no espaço tridimensional com coordenadas inteiras.
- * Suporta operações de subtração, produto vetorial (cross) e produto escalar (dot).
+ * Suporta operações de soma, subtração, produto vetorial (cross) e produto escalar (dot).
  */
 struct Point3D {
   int x, y, z;
@@ -40,26 +82,61 @@ struct Point3D {
     return Point3D(x - other.x, y - other.y, z - other.z);
   }
 
+  /**
+   * Operador de soma entre vetores. Retorna o vetor resultante de this + other.
+   * @param other Vetor a ser somado
+   * @return Vetor resultante da soma
+   */
+  Point3D operator+(const Point3D& other) const {
+    return Point3D(x + other.x, y + other.y, z + other.z);
+  }
+
   
   /**
    * Calcula o produto vetorial (cross product) entre este vetor e outro.
-   * O resultado é um vetor perpendicular aos dois vetores.
+   * O resultado é um vetor perpendicular aos dois vetores, calculado em 64 bits.
    * @param other Outro vetor
    * @return Vetor resultante do produto vetorial
   */
-  Point3D cross(const Point3D& other) const {
-    return Point3D(
-      y * other.z - z * other.y,
-      z * other.x - x * other.z,
-      x * other.y - y * other.x
-    );
+  Vec3L cross(const Point3D& other) const;
+
+  long long dot(const Point3D& other) const {
+    return (long long)x * other.x + (long long)y * other.y + (long long)z * other.z;
   }
+};
 
-  int dot(const Point3D& other) const {
-    return x * other.x + y * other.y + z * other.z;
+// ======================================================================================================================= //
+
+/**
+ * Vetor com componentes de 64 bits, usado para normais de planos. O produto vetorial de duas diferenças
+ * de coordenadas passa de int já com coordenadas na casa das dezenas de milhares.
+ */
+struct Vec3L {
+  long long x, y, z;
+
+  Vec3L() : x(0), y(0), z(0) {}
+  Vec3L(long long x, long long y, long long z) : x(x), y(y), z(z) {}
+
+  /**
+   * Produto escalar exato com um vetor de coordenadas inteiras.
+   * @param other Outro vetor
+   * @return Produto escalar em 128 bits
+   */
+  Int128 dot(const Point3D& other) const {
+    return (Int128)x * other.x + (Int128)y * other.y + (Int128)z * other.z;
   }
+
+  bool isZero() const { return x == 0 && y == 0 && z == 0; }
 };
 
+inline Vec3L Point3D::cross(const Point3D& other) const {
+  return Vec3L(
+    (long long)y * other.z - (long long)z * other.y,
+    (long long)z * other.x - (long long)x * other.z,
+    (long long)x * other.y - (long long)y * other.x
+  );
+}
+
 // ======================================================================================================================= //
 
 /**
@@ -97,10 +174,10 @@ struct Segment {
  */
 struct Plane {
   Point3D point;
-  Point3D normal;
+  Vec3L normal;
 
   Plane() = default;
-  Plane(const Point3D& p, const Point3D& n) : point(p), normal(n) {}
+  Plane(const Point3D& p, const Vec3L& n) : point(p), normal(n) {}
 };
 
 // ======================================================================================================================= //
@@ -116,6 +193,172 @@ enum class Position { FRONT, BACK, SPANNING, COPLANAR };
 
 // ======================================================================================================================= //
 
+/**
+ * Estratégias de escolha do triângulo divisor em cada nó da BSP.
+ * - FIRST: usa o primeiro triângulo da lista (comportamento original)
+ * - RANDOM: sorteia k candidatos e fica com o de menor custo (spans + desbalanceamento)
+ * - BALANCED: avalia todos os triângulos do nó com o custo spans + desbalanceamento
+ * - SAH: sorteia k candidatos e usa a heurística de área de superfície das caixas dos filhos
+ */
+enum class SplitStrategy { FIRST, RANDOM, BALANCED, SAH };
+
+// ======================================================================================================================= //
+
+/**
+ * Conjunto de instruções usado pelo teste de interseção em pacote nas folhas da BSP.
+ * - AUTO: o melhor disponível na CPU, detectado em tempo de execução
+ * - SCALAR: um triângulo por vez, com segmentIntersectsTriangle
+ * - SSE4: 2 triângulos por vez
+ * - AVX2: 4 triângulos por vez
+ */
+enum class SimdLevel { AUTO, SCALAR, SSE4, AVX2 };
+
+// ======================================================================================================================= //
+
+/**
+ * Parâmetros de construção da BSP.
+ * @param strategy Estratégia de escolha do divisor
+ * @param candidates Número de candidatos sorteados por nó (RANDOM e SAH)
+ * @param seed Semente do sorteio; cada nó deriva a sua própria, então a árvore é reprodutível
+ * @param split_spanning Recorta triângulos SPANNING em fragmentos em vez de duplicá-los nas duas subárvores
+ * @param threads Número de threads da construção (0 usa todos os núcleos disponíveis); subárvores grandes viram
+ * tarefas independentes
+ * @param leaf_size Nós com até leaf_size triângulos viram folhas com um balde de triângulos (0 desliga)
+ * @param max_depth Nós nessa profundidade viram folhas com todos os seus triângulos (0 desliga; a raiz tem profundidade 1)
+ * @param min_triangles Número mínimo de triângulos que a divisão precisa tirar do maior filho; abaixo disso o nó
+ *                      vira folha (1, o padrão, aceita qualquer divisão)
+ */
+struct BuildOptions {
+  SplitStrategy strategy = SplitStrategy::FIRST;
+  int candidates = 8;
+  unsigned long long seed = 0;
+  bool split_spanning = false;
+  int threads = 1;
+  int leaf_size = 0;
+  int max_depth = 0;
+  int min_triangles = 1;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Parâmetros das consultas.
+ * @param threads Número de threads de consulta (0 usa todos os núcleos disponíveis)
+ * @param simd Conjunto de instruções do teste em pacote nas folhas
+ * @param clip Recorta o segmento em cada plano divisor e desce em cada filho só com o seu pedaço
+ * @param any_hit Para no primeiro triângulo encontrado (com recorte); cada resultado tem no máximo um índice
+ * @param coherent Processa os segmentos na ordem da curva de Morton dos pontos médios; sem recorte, grupos de
+ *                 segmentos vizinhos percorrem a árvore juntos. A saída continua na ordem da entrada.
+ * @param stats Acumula contadores de percurso em QuerySession::stats(); desligado, o custo é um teste de ponteiro
+ *              nulo por nó e por teste de triângulo
+ */
+struct QueryOptions {
+  int threads = 1;
+  SimdLevel simd = SimdLevel::AUTO;
+  bool clip = false;
+  bool any_hit = false;
+  bool coherent = false;
+  bool stats = false;
+};
+
+struct TriangleCache;
+struct TrianglePackets;
+class SpatialIndex;
+
+/**
+ * Contadores das consultas, preenchidos só com QueryOptions::stats.
+ * @param segments Segmentos consultados
+ * @param nodes_visited Nós cuja caixa foi atravessada, somados sobre todos os segmentos
+ * @param visit_histogram Segmentos por número de nós visitados: a posição 0 conta os que não visitaram nenhum e a
+ *                        posição k > 0 os que visitaram entre 2^(k-1) e 2^k - 1
+ * @param triangle_tests Testes segmento-triângulo, nos divisores e nos baldes das folhas
+ * @param hits Testes que encontraram interseção (triângulos SPANNING podem contar mais de uma vez)
+ * @param parallel_tests Testes com o segmento paralelo ao plano do triângulo; o teste em pacote os refaz no escalar
+ * @param coplanar_tests Desses, os com o segmento no plano, resolvidos pela interseção 2D
+ * @param query_ms Tempo de parede somado das chamadas a QuerySession::run
+ */
+struct QueryStats {
+  static const int HISTOGRAM_BINS = 32;
+
+  size_t segments = 0;
+  size_t nodes_visited = 0;
+  size_t visit_histogram[HISTOGRAM_BINS] = {};
+  size_t triangle_tests = 0;
+  size_t hits = 0;
+  size_t parallel_tests = 0;
+  size_t coplanar_tests = 0;
+  double query_ms = 0;
+
+  /**
+   * Registra um segmento que visitou visited nós.
+   */
+  void addSegment(size_t visited) {
+    int bin = visited ? 64 - __builtin_clzll(visited) : 0;
+    segments++;
+    visit_histogram[min(bin, HISTOGRAM_BINS - 1)]++;
+  }
+
+  /**
+   * Registra um teste do segmento ab contra o triângulo index.
+   */
+  void countTest(const Point3D& a, const Point3D& b, const TriangleCache& cache, int index, bool hit);
+
+  /**
+   * Registra os testes de ab contra as linhas [row, row + count) dos pacotes, dos quais found acertaram.
+   */
+  void countPacketTests(const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, size_t row, size_t count, size_t found);
+
+  /**
+   * Soma os contadores de other a estes.
+   */
+  void merge(const QueryStats& other);
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Limites que disparam a reconstrução de uma subárvore em DynamicBSP.
+ * @param max_dead_ratio Fração máxima das entradas de uma subárvore que podem ser de triângulos removidos
+ * @param max_insert_ratio Fração máxima de entradas inseridas desde a última construção, relativa ao tamanho que a
+ *                         subárvore tinha então; inserções descem sem escolha de divisor e desequilibram a subárvore
+ * @param min_rebuild Subárvores com menos entradas que isso não são reconstruídas por conta própria
+ */
+struct UpdateOptions {
+  double max_dead_ratio = 0.25;
+  double max_insert_ratio = 0.5;
+  int min_rebuild = 32;
+};
+
+/**
+ * Contadores de trabalho de uma DynamicBSP.
+ * @param rebuilds Subárvores reconstruídas
+ * @param rebuilt_triangles Soma dos triângulos vivos dessas subárvores
+ */
+struct UpdateStats {
+  size_t rebuilds = 0;
+  size_t rebuilt_triangles = 0;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Estatísticas de forma de uma árvore BSP já construída.
+ * @param nodes Número total de nós
+ * @param depth Profundidade máxima (a raiz tem profundidade 1)
+ * @param depth_sum Soma das profundidades de todos os nós; depth_sum / nodes é a profundidade média
+ * @param leaves Número de folhas com balde
+ * @param max_bucket Maior balde
+ */
+struct TreeStats {
+  int nodes = 0;
+  int depth = 0;
+  long long depth_sum = 0;
+  int leaves = 0;
+  int max_bucket = 0;
+};
+
+// ======================================================================================================================= //
+
 /**
  * Estrutura que agrupa todos os dados de entrada utilizados na construção da BSP e na verificação de interseções.
  * Contém vetores de pontos (vértices), triângulos (faces) e segmentos.
@@ -125,6 +368,38 @@ struct BSPData {
   vector<Triangle> triangles;
   vector<Segment> segments;
 
+  /**
+   * Imprime a lista de pontos para fins de depuração.
+   */
+  void printPoints() const;
+
+  /**
+   * Imprime a lista de triângulos para fins de depuração.
+   */
+  void printTriangles() const;
+
+  /**
+   * Imprime a lista de segmentos para fins de depuração.
+   */
+  void printSegments() const;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Visão dos mesmos dados de BSPData sem posse da memória. Pode apontar para um BSPData ou para arrays
+ * mapeados de um arquivo binário.
+ */
+struct BSPDataView {
+  Span<Point3D> points;
+  Span<Triangle> triangles;
+  Span<Segment> segments;
+
+  BSPDataView() = default;
+  BSPDataView(const BSPData& data) : points(data.points), triangles(data.triangles), segments(data.segments) {}
+  BSPDataView(Span<Point3D> points, Span<Triangle> triangles, Span<Segment> segments)
+    : points(points), triangles(triangles), segments(segments) {}
+
   /**
    * Imprime a lista de pontos para fins de depuração.
    */
@@ -154,18 +429,254 @@ struct BSPData {
   }
 };
 
+inline void BSPData::printPoints() const { BSPDataView(*this).printPoints(); }
+inline void BSPData::printTriangles() const { BSPDataView(*this).printTriangles(); }
+inline void BSPData::printSegments() const { BSPDataView(*this).printSegments(); }
+
+// ======================================================================================================================= //
+
+/**
+ * Caixa alinhada aos eixos, com limites inclusivos, que envolve todos os triângulos de uma subárvore da BSP.
+ */
+struct NodeBox {
+  int lo[3];
+  int hi[3];
+};
+
 // ======================================================================================================================= //
 
 /**
  * Representa um nó da árvore BSP (Binary Space Partitioning).
  * Cada nó armazena um índice de triângulo usado para dividir o espaço e o plano associado,
- * além de ponteiros para as subárvores da frente e de trás.
+ * além de ponteiros para as subárvores da frente e de trás. Folhas (BuildOptions::leaf_size)
+ * não têm plano nem filhos: guardam em bucket os triângulos que a consulta testa um a um.
+ * Nós e baldes vivem nas arenas de um BSPTree, que os libera de uma vez.
  */
 struct BSPNode {
-  int triangle_index;               // Índice do triângulo usado como divisor
+  int triangle_index = -1;          // Índice do triângulo usado como divisor (-1 nas folhas)
   Plane plane;                      // Plano que divide o espaço neste nó
-  unique_ptr<BSPNode> front;        // Subárvore do lado da frente
-  unique_ptr<BSPNode> back;         // Subárvore do lado de trás
+  BSPNode* front = nullptr;         // Subárvore do lado da frente
+  BSPNode* back = nullptr;          // Subárvore do lado de trás
+  Span<int> bucket;                 // Triângulos da folha, em ordem crescente
+  NodeBox box;                      // Caixa de todos os triângulos da subárvore
+  int references = 0;               // Entradas de triângulos na subárvore, com repetições (só em DynamicBSP)
+  int dead = 0;                     // Dessas entradas, as de triângulos removidos
+  int inserted = 0;                 // Dessas entradas, as inseridas desde a última construção da subárvore
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Memória usada por uma construção da BSP.
+ * @param allocations Número de blocos pedidos ao sistema (blocos das arenas e vetores de rascunho)
+ * @param peak_bytes Maior quantidade de bytes em uso ao mesmo tempo durante a construção
+ * @param tree_bytes Bytes que continuam em uso pela árvore depois da construção
+ */
+struct BuildMemoryStats {
+  size_t allocations = 0;
+  size_t peak_bytes = 0;
+  size_t tree_bytes = 0;
+};
+
+/**
+ * Recurso de memória que repassa os pedidos a new/delete contando alocações, bytes em uso e o pico.
+ * Pode ser usado por várias threads ao mesmo tempo.
+ */
+class CountingResource : public pmr::memory_resource {
+public:
+  /**
+   * @return Contadores até agora; tree_bytes são os bytes ainda em uso
+   */
+  BuildMemoryStats stats() const;
+
+private:
+  atomic<size_t> allocations_{0};
+  atomic<size_t> bytes_{0};
+  atomic<size_t> peak_{0};
+
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+/**
+ * Árvore BSP de ponteiros produzida por buildBSP. Os nós e os baldes ficam em arenas monotônicas, uma por
+ * tarefa de construção, e são liberados de uma vez quando a árvore é destruída ou em reset().
+ */
+struct BSPTree {
+  unique_ptr<CountingResource> memory;                          // Origem das arenas; declarada antes para ser destruída depois
+  vector<unique_ptr<pmr::monotonic_buffer_resource>> arenas;
+  BSPNode* root = nullptr;
+  BuildMemoryStats stats;                                       // Memória usada pela construção
+  size_t spanning = 0;                                          // Triângulos SPANNING duplicados ou recortados nos nós internos
+
+  const BSPNode* get() const { return root; }
+
+  /**
+   * Libera todos os nós.
+   */
+  void reset() {
+    root = nullptr;
+    arenas.clear();
+    memory.reset();
+  }
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Nó da BSP linearizada. O plano é guardado como normal + deslocamento d = n · p, de modo que o lado
+ * de um ponto q é o sinal de n · q - d. Os filhos são posições no vetor de nós (FLAT_NONE se ausentes).
+ * Planos cuja normal ou deslocamento não cabem aqui (coordenadas grandes) ficam em FlatBSP::wide_planes:
+ * o nó marca nx = FLAT_WIDE e d passa a ser o índice do plano naquele vetor.
+ * Folhas marcam nx = FLAT_LEAF; d é a posição do balde em FlatBSP::leaf_triangles e triangle_index
+ * o seu tamanho.
+ */
+struct FlatNode {
+  int nx, ny, nz;                   // Normal do plano divisor
+  int triangle_index;               // Índice do triângulo usado como divisor
+  long long d;                      // Deslocamento do plano (n · p)
+  uint32_t front;                   // Filho da frente
+  uint32_t back;                    // Filho de trás
+};
+
+const uint32_t FLAT_NONE = UINT32_MAX;
+const int FLAT_WIDE = INT_MIN;
+const int FLAT_LEAF = INT_MIN + 1;
+
+/**
+ * Plano de um nó com normal de 64 bits e deslocamento de 128 bits.
+ */
+struct WidePlane {
+  long long n[3];
+  long long pad;                    // Alinha d sem deixar bytes indefinidos no arquivo da árvore
+  Int128 d;
+};
+
+/**
+ * BSP em um único vetor contíguo, em pré-ordem com o filho da frente logo após o pai.
+ * A raiz, se existir, é nodes[0]. Os baldes das folhas ficam em sequência, na ordem das folhas.
+ * boxes[i] é a caixa da subárvore de nodes[i]; fica fora do nó para mantê-lo em 32 bytes.
+ */
+struct FlatBSP {
+  vector<FlatNode> nodes;
+  vector<WidePlane> wide_planes;
+  vector<int> leaf_triangles;
+  vector<NodeBox> boxes;
+};
+
+static_assert(sizeof(FlatNode) == 32, "FlatNode deve ocupar 32 bytes");
+
+/**
+ * Visão de uma BSP linearizada sem posse da memória. Pode apontar para um FlatBSP ou para
+ * uma árvore mapeada de arquivo.
+ */
+struct FlatBSPView {
+  Span<FlatNode> nodes;
+  Span<WidePlane> wide_planes;
+  Span<int> leaf_triangles;
+  Span<NodeBox> boxes;
+
+  FlatBSPView() = default;
+  FlatBSPView(const FlatBSP& tree)
+    : nodes(tree.nodes), wide_planes(tree.wide_planes), leaf_triangles(tree.leaf_triangles), boxes(tree.boxes) {}
+  FlatBSPView(Span<FlatNode> nodes, Span<WidePlane> wide_planes, Span<int> leaf_triangles, Span<NodeBox> boxes)
+    : nodes(nodes), wide_planes(wide_planes), leaf_triangles(leaf_triangles), boxes(boxes) {}
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Triângulos intersectados por um segmento, sem alocação por consulta. Cada triângulo tem um carimbo com a
+ * última época em que foi inserido; clear() só avança a época, então a deduplicação não precisa limpar nada.
+ * Cada thread de consulta usa o seu.
+ */
+struct HitSet {
+  vector<uint32_t> stamps;          // Época da última inserção de cada índice
+  uint32_t epoch = 1;
+  vector<int> hits;                 // Índices (1-based) da consulta atual, na ordem de inserção
+
+  /**
+   * @param triangles Número de triângulos da malha
+   */
+  explicit HitSet(size_t triangles = 0) : stamps(triangles + 1, 0) {}
+
+  /**
+   * Insere um índice 1-based, se ainda não estiver no conjunto.
+   */
+  void insert(int index) {
+    if (stamps[index] == epoch) return;
+    stamps[index] = epoch;
+    hits.push_back(index);
+  }
+
+  /**
+   * Esvazia o conjunto para a próxima consulta.
+   */
+  void clear() {
+    hits.clear();
+    if (++epoch == 0) {
+      // A época deu a volta: carimbos antigos poderiam coincidir com a nova
+      fill(stamps.begin(), stamps.end(), 0);
+      epoch = 1;
+    }
+  }
+};
+
+/**
+ * Resultado das consultas em formato CSR: os triângulos do segmento i são ids[offsets[i]] até
+ * ids[offsets[i + 1] - 1], em ordem crescente. offsets tem uma posição a mais que o número de segmentos.
+ */
+struct QueryResults {
+  vector<size_t> offsets{0};
+  vector<int> ids;
+
+  size_t size() const { return offsets.size() - 1; }
+
+  /**
+   * @param i Índice do segmento
+   * @return Índices (1-based) dos triângulos intersectados pelo segmento i
+   */
+  Span<int> operator[](size_t i) const { return Span<int>(ids.data() + offsets[i], offsets[i + 1] - offsets[i]); }
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Dados de cada triângulo calculados uma vez, antes da construção, e guardados como estrutura de arrays:
+ * primeiro vértice p0, arestas e1 = p1 - p0 e e2 = p2 - p0, normal n = e1 x e2 e deslocamento do plano
+ * d = n · p0. A construção e as consultas leem daqui em vez de seguir os índices 1-based dos triângulos e
+ * recalcular o plano a cada teste. Assim como em FlatNode, d só é guardado quando as componentes da normal
+ * ficam abaixo de 2^30; nos demais triângulos vale 0 e o lado é calculado a partir de p0 em 128 bits.
+ */
+struct TriangleCache {
+  vector<int> x0, y0, z0;           // Primeiro vértice
+  vector<int> e1x, e1y, e1z;        // Aresta p1 - p0
+  vector<int> e2x, e2y, e2z;        // Aresta p2 - p0
+  vector<long long> nx, ny, nz;     // Normal do plano
+  vector<long long> d;              // Deslocamento do plano (n · p0)
+  vector<int> original;             // Se não vazio, triângulo da entrada (0-based) de cada linha (ver CompactMesh)
+  int max_coord = 0;                // Maior módulo de coordenada entre os vértices
+
+  size_t size() const { return x0.size(); }
+
+  Point3D edge1(size_t i) const { return Point3D(e1x[i], e1y[i], e1z[i]); }
+  Point3D edge2(size_t i) const { return Point3D(e2x[i], e2y[i], e2z[i]); }
+  Vec3L normal(size_t i) const { return Vec3L(nx[i], ny[i], nz[i]); }
+
+  /**
+   * Vértice k (0, 1 ou 2) do triângulo i, na ordem em que aparece na entrada.
+   */
+  Point3D vertex(size_t i, int k) const {
+    Point3D p0(x0[i], y0[i], z0[i]);
+    if (k == 0) return p0;
+    return p0 + (k == 1 ? edge1(i) : edge2(i));
+  }
+
+  /**
+   * Plano do triângulo i, igual ao produzido por computePlane sobre os seus vértices.
+   */
+  Plane plane(size_t i) const { return Plane(vertex(i, 0), normal(i)); }
 };
 
 // ======================================================================================================================= //
@@ -179,6 +690,28 @@ struct BSPNode {
  */
 Plane computePlane(const Point3D& p1, const Point3D& p2, const Point3D& p3);
 
+/**
+ * Monta o cache de vértices, arestas e planos dos triângulos.
+ * @param triangles Vetor de triângulos
+ * @param points Vetor de pontos
+ * @return Cache com uma entrada por triângulo, na mesma ordem
+ */
+TriangleCache buildTriangleCache(Span<Triangle> triangles, Span<Point3D> points);
+
+/**
+ * Acrescenta um triângulo ao fim do cache.
+ * @param cache Cache a ser estendido
+ * @param a Primeiro vértice
+ * @param b Segundo vértice
+ * @param c Terceiro vértice
+ */
+void appendTriangle(TriangleCache& cache, const Point3D& a, const Point3D& b, const Point3D& c);
+
+/**
+ * Reserva espaço para n triângulos, para uma sequência de appendTriangle sem realocações.
+ */
+void reserveTriangleCache(TriangleCache& cache, size_t n);
+
 /**
  * Classifica um ponto em relação a um plano.
  * @param plane O plano de referência
@@ -194,16 +727,90 @@ int classifyPointToPlane(const Plane& plane, const Point3D& point);
  * @param points Vetor de pontos do espaço
  * @return Posição do triângulo: FRONT, BACK, COPLANAR ou SPANNING
  */
-Position classifyTriangle(const Plane& plane, const Triangle& tri, const vector<Point3D>& points);
+Position classifyTriangle(const Plane& plane, const Triangle& tri, Span<Point3D> points);
 
 /**
- * Constrói uma árvore BSP recursivamente a partir de triângulos.
+ * Classifica um triângulo do cache em relação a um plano.
+ * @param plane O plano de referência
+ * @param cache Cache dos triângulos
+ * @param index Índice do triângulo
+ * @return Posição do triângulo: FRONT, BACK, COPLANAR ou SPANNING
+ */
+Position classifyTriangle(const Plane& plane, const TriangleCache& cache, int index);
+
+/**
+ * Escolhe, entre os triângulos de um nó, aquele que será usado como plano divisor.
+ * @param cache Cache dos triângulos
+ * @param triangle_indices Índices dos triângulos do nó
+ * @param count Quantidade de índices (maior que zero)
+ * @param options Parâmetros de construção
+ * @param seed Semente do nó, usada pelas estratégias com sorteio
+ * @return Posição, dentro de triangle_indices, do triângulo escolhido
+ */
+size_t chooseSplitter(const TriangleCache& cache, const int* triangle_indices, size_t count, const BuildOptions& options, unsigned long long seed);
+
+/**
+ * Converte o nome de uma estratégia de divisão ("first", "random", "balanced" ou "sah") para o enum.
+ * @param name Nome da estratégia
+ * @param strategy Recebe a estratégia, se o nome for válido
+ * @return false se o nome não corresponde a nenhuma estratégia
+ */
+bool parseSplitStrategy(const string& name, SplitStrategy& strategy);
+
+/**
+ * @param strategy Estratégia de divisão
+ * @return Nome da estratégia, o mesmo aceito por parseSplitStrategy
+ */
+const char* splitStrategyName(SplitStrategy strategy);
+
+/**
+ * Constrói uma árvore BSP recursivamente a partir de triângulos. A árvore produzida não depende
+ * de options.threads.
  * @param triangles Vetor de triângulos
  * @param points Vetor de pontos
  * @param triangle_indices Índices dos triângulos a serem inseridos
- * @return Ponteiro para o nó raiz da árvore BSP construída
+ * @param options Parâmetros de construção (estratégia de divisão)
+ * @return Árvore construída, dona dos seus nós
+ */
+BSPTree buildBSP(Span<Triangle> triangles, Span<Point3D> points, vector<int> triangle_indices, const BuildOptions& options = BuildOptions());
+
+/**
+ * Constrói a BSP lendo vértices e planos de um cache já montado.
+ * @param cache Cache dos triângulos
+ * @param triangle_indices Índices dos triângulos a serem inseridos
+ * @param options Parâmetros de construção (estratégia de divisão)
+ * @return Árvore construída, dona dos seus nós
+ */
+BSPTree buildBSP(const TriangleCache& cache, vector<int> triangle_indices, const BuildOptions& options = BuildOptions());
+
+/**
+ * Verifica se as coordenadas permitem recortar triângulos de forma exata (aritmética de 128 bits).
+ * Fora desse limite, buildBSP ignora split_spanning e volta a duplicar os triângulos SPANNING.
+ * @param points Vetor de pontos
+ * @return true se todas as coordenadas têm módulo até 4096
+ */
+bool canSplitExactly(Span<Point3D> points);
+
+/**
+ * Mesma verificação de canSplitExactly, restrita aos vértices dos triângulos do cache.
+ * @param cache Cache dos triângulos
+ * @return true se todas as coordenadas têm módulo até 4096
  */
-unique_ptr<BSPNode> buildBSP(const vector<Triangle>& triangles, const vector<Point3D>& points, vector<int> triangle_indices);
+bool canSplitExactly(const TriangleCache& cache);
+
+/**
+ * Calcula o número de nós e a profundidade máxima de uma árvore BSP.
+ * @param node Raiz da árvore
+ * @return Estatísticas da árvore
+ */
+TreeStats computeTreeStats(const BSPNode* node);
+
+/**
+ * Converte a árvore de ponteiros produzida por buildBSP para o layout linear.
+ * @param root Raiz da árvore
+ * @return Árvore linearizada
+ */
+FlatBSP flattenBSP(const BSPNode* root);
 
 /**
  * Verifica se um segmento cruza um plano.
@@ -214,6 +821,27 @@ unique_ptr<BSPNode> buildBSP(const vector<Triangle>& triangles, const vector<Poi
  */
 bool segmentIntersectsPlane(const Point3D& a, const Point3D& b, const Plane& plane);
 
+/**
+ * Verifica se um segmento toca uma caixa alinhada aos eixos (teste de slabs exato, com frações inteiras).
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param box Caixa com limites inclusivos
+ * @return true se algum ponto do segmento está na caixa
+ */
+bool segmentIntersectsBox(const Point3D& a, const Point3D& b, const NodeBox& box);
+
+/**
+ * @param cache Cache dos triângulos
+ * @param index Triângulo (0-based)
+ * @return Menor caixa que contém o triângulo
+ */
+NodeBox triangleBox(const TriangleCache& cache, int index);
+
+/**
+ * Aumenta box até conter other.
+ */
+void growBox(NodeBox& box, const NodeBox& other);
+
 /**
  * Verifica se um segmento intersecta um triângulo.
  * @param a Ponto inicial do segmento
@@ -222,25 +850,286 @@ bool segmentIntersectsPlane(const Point3D& a, const Point3D& b, const Plane& pla
  * @param points Vetor de pontos
  * @return true se o segmento intersecta o triângulo
  */
-bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const Triangle& tri, const vector<Point3D>& points);
+bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const Triangle& tri, Span<Point3D> points);
 
 /**
- * Percorre a BSP para encontrar interseções entre um segmento e triângulos.
+ * Mesmo teste de segmentIntersectsTriangle, sobre os dados de um triângulo do cache.
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param cache Cache dos triângulos
+ * @param index Índice do triângulo
+ * @return true se o segmento intersecta o triângulo
+ */
+bool segmentIntersectsTriangle(const Point3D& a, const Point3D& b, const TriangleCache& cache, int index);
+
+/**
+ * Percorre a BSP para encontrar interseções entre um segmento e triângulos. Subárvores cuja caixa o
+ * segmento não toca são descartadas.
  * @param node Nó atual da BSP
  * @param a Ponto inicial do segmento
  * @param b Ponto final do segmento
- * @param triangles Vetor de triângulos
- * @param points Vetor de pontos
- * @param result Conjunto onde os índices dos triângulos intersectados serão inseridos
+ * @param cache Cache dos triângulos
+ * @param result Conjunto onde os índices (1-based) dos triângulos intersectados serão inseridos
+ */
+void queryBSP(const BSPNode* node, const Point3D& a, const Point3D& b, const TriangleCache& cache, HitSet& result);
+
+/**
+ * Percorre a BSP linearizada de forma iterativa, com pilha explícita, coletando os triângulos intersectados.
+ * Subárvores cuja caixa (tree.boxes) o segmento não toca são descartadas, e os baldes das folhas são
+ * testados em pacote (ver packet.hpp).
+ * @param tree Árvore linearizada
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param cache Cache dos triângulos
+ * @param packets Dados dos baldes de tree.leaf_triangles, montados por buildTrianglePackets
+ * @param result Conjunto onde os índices (1-based) dos triângulos intersectados serão inseridos
+ * @param stats Se não nulo, recebe os nós visitados e os testes de triângulo (mas não o segmento, ver addSegment)
+ */
+void queryFlatBSP(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, HitSet& result, QueryStats* stats = nullptr);
+
+/**
+ * Como queryFlatBSP, mas leva para baixo o intervalo paramétrico [t0, t1] do segmento a + (b - a) t: em cada
+ * nó o intervalo é cortado no plano divisor e cada filho só recebe o pedaço do seu lado. Os extremos do
+ * intervalo são guardados como raízes de funções lineares com coeficientes inteiros, então o corte é exato.
+ * @param tree Árvore linearizada
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param cache Cache dos triângulos
+ * @param packets Dados dos baldes de tree.leaf_triangles, montados por buildTrianglePackets
+ * @param result Conjunto onde os índices (1-based) dos triângulos intersectados serão inseridos
+ * @param stats Como em queryFlatBSP
+ */
+void queryFlatBSPClipped(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, HitSet& result, QueryStats* stats = nullptr);
+
+/**
+ * Percorre a BSP com recorte, do lado de a para o lado de b, e para no primeiro triângulo intersectado.
+ * O triângulo devolvido não é necessariamente o mais próximo de a.
+ * @param tree Árvore linearizada
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param cache Cache dos triângulos
+ * @param packets Dados dos baldes de tree.leaf_triangles, montados por buildTrianglePackets
+ * @param stats Como em queryFlatBSP
+ * @return Índice (1-based) de um triângulo intersectado, ou 0 se não há nenhum
+ */
+int queryFlatBSPAnyHit(const FlatBSPView& tree, const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, QueryStats* stats = nullptr);
+
+/**
+ * Código de Morton de p quantizado em 21 bits por eixo dentro da caixa [lo, hi]. As coordenadas podem ser
+ * somas de até três vértices (|c| < 2^32).
  */
-void queryBSP(const BSPNode* node, const Point3D& a, const Point3D& b, const vector<Triangle>& triangles, const vector<Point3D>& points, set<int>& result);
+uint64_t mortonCode(const long long p[3], const long long lo[3], const long long hi[3]);
+
+/**
+ * Estado de consulta reaproveitado entre lotes de segmentos: os pacotes dos baldes, e por thread um
+ * HitSet e os buffers de saída. É montado uma vez sobre a árvore; depois, cada lote custa só o
+ * proporcional aos seus segmentos, e como os buffers mantêm a capacidade entre lotes, a memória não
+ * cresce com o total de segmentos respondidos.
+ */
+class QuerySession {
+public:
+  /**
+   * @param cache Cache dos triângulos sobre os quais a árvore foi construída
+   * @param tree BSP linearizada; precisa continuar válida enquanto a sessão existir
+   * @param options Threads, conjunto de instruções e modo de percurso das consultas
+   */
+  QuerySession(const TriangleCache& cache, const FlatBSPView& tree, const QueryOptions& options);
+
+  /**
+   * Sessão sobre qualquer estrutura de aceleração. Uma BSPIndex usa os percursos próprios da BSP (recorte,
+   * pacotes de segmentos) e os pacotes de triângulos dela; nas demais cada segmento é respondido por
+   * SpatialIndex::query, --clip não se aplica e --any-hit devolve o menor índice intersectado.
+   * @param cache Cache dos triângulos sobre os quais a estrutura foi construída
+   * @param index Estrutura já construída; precisa continuar válida enquanto a sessão existir
+   * @param options Threads, conjunto de instruções e modo de percurso das consultas
+   */
+  QuerySession(const TriangleCache& cache, const SpatialIndex& index, const QueryOptions& options);
+  ~QuerySession();
+
+  QuerySession(const QuerySession&) = delete;
+  QuerySession& operator=(const QuerySession&) = delete;
+
+  /**
+   * Responde um lote de segmentos. Com mais de uma thread, os segmentos são distribuídos em blocos sob
+   * demanda; a ordem da saída é a mesma do caso serial.
+   * @param segments Segmentos do lote
+   * @param results Substituído pelos triângulos intersectados por cada segmento; a capacidade é reaproveitada
+   */
+  void run(Span<Segment> segments, QueryResults& results);
+
+  /**
+   * @return Contadores somados de todas as chamadas a run (zerados se QueryOptions::stats está desligado)
+   */
+  const QueryStats& stats() const { return stats_; }
+
+private:
+  // Saída de uma thread: contagens e índices dos blocos que ela processou
+  struct ThreadState {
+    HitSet intersected;
+    vector<uint32_t> counts;
+    vector<int> ids;
+    vector<vector<int>> lanes;                  // Acertos de cada segmento de um pacote (modo coerente)
+    QueryStats stats;                           // Contadores do lote atual (QueryOptions::stats)
+  };
+
+  // Posição, no buffer da sua thread, dos índices de um segmento (modo coerente)
+  struct Placement {
+    uint32_t thread;
+    uint32_t count;
+    size_t start;
+  };
+
+  void runBatch(Span<Segment> segments, QueryResults& results);
+  void sortByMorton(Span<Segment> segments);
+
+  void initThreads();
+
+  const TriangleCache& cache_;
+  FlatBSPView tree_;
+  QueryOptions options_;
+  const SpatialIndex* index_ = nullptr;         // Estrutura que não é BSP; nulo nos percursos da BSP
+  unique_ptr<TrianglePackets> own_packets_;     // Pacotes montados pela sessão, se a estrutura não os trouxe
+  const TrianglePackets* packets_ = nullptr;
+  vector<ThreadState> states_;
+  vector<int> chunk_thread_;                    // Thread que processou cada bloco
+  vector<pair<size_t, size_t>> chunk_start_;    // Início de cada bloco nos buffers da sua thread
+  vector<pair<uint64_t, uint32_t>> order_;      // Modo coerente: (código de Morton, segmento), em ordem
+  vector<Placement> placement_;                 // Modo coerente: onde está cada segmento, na ordem de order_
+  QueryStats stats_;
+};
 
 /**
  * Processa todos os segmentos e determina os triângulos que cada um intersecta.
  * @param data Estrutura contendo pontos, triângulos, segmentos e BSP construída
- * @return Vetor de vetores contendo os índices dos triângulos interceptados por cada segmento
+ * @return Índices dos triângulos interceptados por cada segmento
+ */
+QueryResults processSegments(const BSPDataView& data);
+
+/**
+ * Processa todos os segmentos usando uma BSP já construída.
+ * @param data Estrutura contendo pontos, triângulos e segmentos
+ * @param tree Raiz da BSP construída sobre data.triangles
+ * @return Índices dos triângulos interceptados por cada segmento
+ */
+QueryResults processSegments(const BSPDataView& data, const BSPNode* tree);
+
+/**
+ * Processa todos os segmentos usando a BSP linearizada. Com mais de uma thread, os segmentos são
+ * distribuídos em blocos sob demanda; a árvore é só lida e a ordem da saída é a mesma do caso serial.
+ * @param data Estrutura contendo pontos, triângulos e segmentos
+ * @param tree BSP linearizada construída sobre data.triangles
+ * @param threads Número de threads de consulta (0 usa todos os núcleos disponíveis)
+ * @return Índices dos triângulos interceptados por cada segmento
  */
-vector<vector<int>> processSegments(const BSPData& data);
+QueryResults processSegments(const BSPDataView& data, const FlatBSPView& tree, int threads = 1);
+
+/**
+ * Igual à versão anterior, reaproveitando o cache de triângulos usado na construção.
+ * @param data Estrutura contendo pontos, triângulos e segmentos
+ * @param cache Cache montado sobre data.triangles
+ * @param tree BSP linearizada construída sobre data.triangles
+ * @param options Threads, conjunto de instruções e modo de percurso das consultas
+ * @return Índices dos triângulos interceptados por cada segmento
+ */
+QueryResults processSegments(const BSPDataView& data, const TriangleCache& cache, const FlatBSPView& tree, const QueryOptions& options);
+
+// ======================================================================================================================= //
+
+/**
+ * BSP de ponteiros que aceita inserir e remover triângulos sem reconstruir a árvore inteira.
+ * Um triângulo inserido desce classificado contra os planos existentes (SPANNING vai para os dois lados) até um
+ * filho vazio, onde vira um nó novo, ou até uma folha, cujo balde cresce. Um triângulo removido vira tombstone:
+ * continua na árvore, mas as consultas o descartam. Cada nó conta suas entradas, as removidas e as inseridas
+ * desde a sua construção; depois de cada atualização, a subárvore mais alta do caminho que passou de um dos
+ * limites de UpdateOptions é reconstruída só com os triângulos vivos. Se o caminho se bifurcou (SPANNING) e há
+ * subárvores vencidas dos dois lados, o nó da bifurcação é reconstruído uma vez no lugar delas, então cada
+ * atualização reconstrói no máximo uma subárvore. Assim o custo de uma atualização é o do caminho percorrido
+ * mais uma reconstrução local, amortizada pelas atualizações que a causaram.
+ * Os índices são 1-based, como na saída das consultas; os dos triângulos inseridos seguem os da malha inicial
+ * e não são reaproveitados.
+ */
+class DynamicBSP {
+public:
+  /**
+   * Constrói a árvore sobre todos os triângulos da malha.
+   * @param triangles Vetor de triângulos
+   * @param points Vetor de pontos
+   * @param options Parâmetros da construção, usados também em cada reconstrução local
+   * @param update Limites que disparam as reconstruções locais
+   */
+  DynamicBSP(Span<Triangle> triangles, Span<Point3D> points, const BuildOptions& options = BuildOptions(), const UpdateOptions& update = UpdateOptions());
+
+  DynamicBSP(const DynamicBSP&) = delete;
+  DynamicBSP& operator=(const DynamicBSP&) = delete;
+
+  /**
+   * Insere um triângulo. As coordenadas precisam ter módulo abaixo de COORD_LIMIT.
+   * @return Índice (1-based) do triângulo inserido
+   */
+  int insert(const Point3D& a, const Point3D& b, const Point3D& c);
+
+  /**
+   * Remove um triângulo.
+   * @param index Índice (1-based) do triângulo
+   * @return false se o índice não existe ou o triângulo já tinha sido removido
+   */
+  bool remove(int index);
+
+  /**
+   * @param index Índice (1-based) do triângulo
+   * @return true se o triângulo existe e não foi removido
+   */
+  bool contains(int index) const { return index >= 1 && index <= (int)alive_.size() && alive_[index - 1]; }
+
+  /**
+   * Determina os triângulos vivos intersectados por um segmento.
+   * @param a Ponto inicial do segmento
+   * @param b Ponto final do segmento
+   * @param result Conjunto criado com pelo menos cache().size() triângulos, onde os índices (1-based) serão inseridos
+   */
+  void query(const Point3D& a, const Point3D& b, HitSet& result) const;
+
+  /**
+   * Processa um lote de segmentos.
+   * @param segments Segmentos
+   * @return Índices dos triângulos vivos interceptados por cada segmento
+   */
+  QueryResults query(Span<Segment> segments) const;
+
+  const TriangleCache& cache() const { return cache_; }
+  const BSPNode* root() const { return root_; }
+  UpdateStats stats() const { return stats_; }
+
+private:
+  // Variação dos contadores de uma subárvore, repassada aos ancestrais
+  struct Delta {
+    int references = 0;
+    int dead = 0;
+    int inserted = 0;
+  };
+
+  BSPNode* insertInto(BSPNode* node, int tri);
+  int removeFrom(BSPNode* node, int tri, const NodeBox& box);
+  void refreshPath(int tri);
+  bool markForks(const BSPNode* node, int tri);
+  BSPNode* refresh(BSPNode* node, int tri, Delta& delta);
+  BSPNode* rebuild(BSPNode* node, Delta& delta);
+  bool stale(const BSPNode* node) const;
+  BSPNode* newNode(int tri);
+  BSPNode* adopt(const BSPNode* source);
+  Span<int> newBucket(const int* ids, size_t count, int extra);
+  void release(BSPNode* node);
+  void collect(const BSPNode* node, vector<int>& ids) const;
+
+  TriangleCache cache_;
+  BuildOptions options_;
+  UpdateOptions update_;
+  vector<uint8_t> alive_;                   // 0 nos triângulos removidos
+  pmr::unsynchronized_pool_resource pool_;  // Nós e baldes; os de subárvores reconstruídas voltam para cá
+  vector<const BSPNode*> forks_;            // Bifurcações marcadas por markForks na atualização atual
+  BSPNode* root_ = nullptr;
+  UpdateStats stats_;
+};
 
 /**
  * Verifica se dois segmentos 2D se intersectam.
@@ -280,7 +1169,7 @@ int orientation(pair<int, int> p, pair<int, int> q, pair<int, int> r);
  * @param normal Vetor normal do plano do triângulo
  * @return true se o segmento intersecta o triângulo no plano
  */
-bool segmentTriangleCoplanarIntersect(const Point3D& a, const Point3D& b, const Point3D& p0, const Point3D& p1, const Point3D& p2, const Point3D& normal);
+bool segmentTriangleCoplanarIntersect(const Point3D& a, const Point3D& b, const Point3D& p0, const Point3D& p1, const Point3D& p2, const Vec3L& normal);
 
 /**
  * Verifica se um ponto 2D está dentro de um triângulo 2D.
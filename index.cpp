@@ -0,0 +1,416 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "index.hpp"
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+const char* indexKindName(IndexKind kind) {
+  switch (kind) {
+    case IndexKind::BSP: return "bsp";
+    case IndexKind::GRID: return "grid";
+    case IndexKind::BVH: return "bvh";
+  }
+  return "bsp";
+}
+
+bool parseIndexKind(const string& name, IndexKind& kind) {
+  for (IndexKind candidate : {IndexKind::BSP, IndexKind::GRID, IndexKind::BVH}) {
+    if (name == indexKindName(candidate)) {
+      kind = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+unique_ptr<SpatialIndex> makeSpatialIndex(IndexKind kind, const BuildOptions& options, SimdLevel simd) {
+  switch (kind) {
+    case IndexKind::GRID: return make_unique<GridIndex>(simd);
+    case IndexKind::BVH: return make_unique<BVHIndex>(simd);
+    case IndexKind::BSP: break;
+  }
+  return make_unique<BSPIndex>(options, simd);
+}
+
+// Bytes dos arrays dos pacotes
+static size_t packetBytes(const TrianglePackets& packets) {
+  return packets.x0.size() * sizeof(double) * 13 + packets.ids.size() * sizeof(int);
+}
+
+// Testa as linhas [begin, end) dos pacotes em trechos de até 64, como nos baldes da BSP
+static void testRows(const Point3D& a, const Point3D& b, const TriangleCache& cache, const TrianglePackets& packets, size_t begin, size_t end, HitSet& result, QueryStats* stats) {
+  const size_t hits_size = 64;
+  int hits[hits_size];
+  for (size_t row = begin; row < end; row += hits_size) {
+    size_t found = intersectPacket(a, b, packets, cache, row, min(hits_size, end - row), hits);
+    if (stats) stats->countPacketTests(a, b, cache, packets, row, min(hits_size, end - row), found);
+    for (size_t k = 0; k < found; ++k) result.insert(hits[k] + 1); // índice 1-based
+  }
+}
+
+// ======================================================================================================================= //
+
+BSPIndex::BSPIndex(const BuildOptions& options, SimdLevel simd) : options_(options), simd_(simd) {}
+
+void BSPIndex::build(const TriangleCache& cache) {
+  cache_ = &cache;
+  vector<int> all_indices(cache.size());
+  iota(all_indices.begin(), all_indices.end(), 0);
+
+  BSPTree bsp_tree = buildBSP(cache, move(all_indices), options_);
+  info_.tree = computeTreeStats(bsp_tree.get());
+  info_.spanning = bsp_tree.spanning;
+  info_.memory = bsp_tree.stats;
+
+  auto start = chrono::steady_clock::now();
+  tree_ = flattenBSP(bsp_tree.get());
+  info_.flatten_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  packets_ = buildTrianglePackets(cache, tree_.leaf_triangles, simd_);
+}
+
+void BSPIndex::query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats) const {
+  queryFlatBSP(tree_, a, b, *cache_, packets_, result, stats);
+}
+
+size_t BSPIndex::bytes() const {
+  return tree_.nodes.size() * sizeof(FlatNode) + tree_.wide_planes.size() * sizeof(WidePlane) +
+         tree_.leaf_triangles.size() * sizeof(int) + tree_.boxes.size() * sizeof(NodeBox) + packetBytes(packets_);
+}
+
+string BSPIndex::summary() const {
+  const TreeStats& stats = info_.tree;
+  ostringstream out;
+  out << "BSP (nodes: " << stats.nodes << ", depth: " << stats.depth << ", leaves: " << stats.leaves << ", max bucket: " << stats.max_bucket << ")";
+  return out.str();
+}
+
+// ======================================================================================================================= //
+
+GridIndex::GridIndex(SimdLevel simd, double density) : simd_(simd), density_(density) {}
+
+void GridIndex::build(const TriangleCache& cache) {
+  cache_ = &cache;
+  size_t n = cache.size();
+  cell_start_.clear();
+  cells_[0] = cells_[1] = cells_[2] = 0;
+  if (n == 0) {
+    packets_ = buildTrianglePackets(cache, Span<int>(), simd_);
+    return;
+  }
+
+  vector<NodeBox> boxes(n);
+  for (size_t i = 0; i < n; ++i) boxes[i] = triangleBox(cache, (int)i);
+  bounds_ = boxes[0];
+  for (const NodeBox& box : boxes) growBox(bounds_, box);
+
+  // Células quase cúbicas, density_ por triângulo. Eixos sem extensão (malhas planas) ficam com uma camada e
+  // não entram no volume, senão o lado sairia pequeno demais nos outros eixos.
+  long long extent[3];
+  double volume = 1;
+  int dimensions = 0;
+  for (int k = 0; k < 3; ++k) {
+    extent[k] = (long long)bounds_.hi[k] - bounds_.lo[k];
+    if (extent[k] > 0) {
+      volume *= (double)extent[k];
+      dimensions++;
+    }
+  }
+  double target = max(1.0, min(density_ * (double)n, (double)MAX_CELLS));
+  double side = dimensions ? pow(volume / target, 1.0 / dimensions) : 1.0;
+  for (int k = 0; k < 3; ++k) {
+    long long want = max(1LL, min((long long)ceil((double)extent[k] / max(side, 1.0)), (long long)MAX_CELLS));
+    size_[k] = max(1LL, (extent[k] + want - 1) / want);
+  }
+
+  // O arredondamento para lados inteiros pode passar do limite; dobra os lados até caber
+  auto countCells = [&]() {
+    size_t total = 1;
+    for (int k = 0; k < 3; ++k) {
+      cells_[k] = (int)max(1LL, (extent[k] + size_[k] - 1) / size_[k]);
+      total *= cells_[k];
+    }
+    return total;
+  };
+  while (countCells() > MAX_CELLS) {
+    for (int k = 0; k < 3; ++k) size_[k] *= 2;
+  }
+
+  // Faixa de células (fechadas) que a caixa de um triângulo toca: a célula c vai de lo + c s até lo + (c + 1) s,
+  // então um limite da caixa sobre um plano da grade toca as células dos dois lados
+  auto cellRange = [&](const NodeBox& box, int lo[3], int hi[3]) {
+    for (int k = 0; k < 3; ++k) {
+      long long from = (long long)box.lo[k] - bounds_.lo[k], to = (long long)box.hi[k] - bounds_.lo[k];
+      lo[k] = (int)max(0LL, (from + size_[k] - 1) / size_[k] - 1);
+      hi[k] = (int)min((long long)cells_[k] - 1, to / size_[k]);
+    }
+  };
+
+  // Duas passadas: contagem por célula, depois o preenchimento em CSR
+  size_t total = (size_t)cells_[0] * cells_[1] * cells_[2];
+  cell_start_.assign(total + 1, 0);
+  int lo[3], hi[3];
+  for (const NodeBox& box : boxes) {
+    cellRange(box, lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z)
+      for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int x = lo[0]; x <= hi[0]; ++x) cell_start_[((size_t)z * cells_[1] + y) * cells_[0] + x + 1]++;
+  }
+  for (size_t i = 0; i < total; ++i) cell_start_[i + 1] += cell_start_[i];
+
+  vector<int> cell_triangles(cell_start_[total]);
+  vector<size_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+  for (size_t i = 0; i < n; ++i) {
+    cellRange(boxes[i], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z)
+      for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int x = lo[0]; x <= hi[0]; ++x) cell_triangles[fill[((size_t)z * cells_[1] + y) * cells_[0] + x]++] = (int)i;
+  }
+  packets_ = buildTrianglePackets(cache, cell_triangles, simd_);
+}
+
+void GridIndex::query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats) const {
+  if (cell_start_.empty()) return;
+
+  // Intervalo [t0, t1] = [n0 / d0, n1 / d1] de a + (b - a) t dentro da caixa da grade, como em segmentIntersectsBox
+  long long pa[3] = {a.x, a.y, a.z}, delta[3] = {(long long)b.x - a.x, (long long)b.y - a.y, (long long)b.z - a.z};
+  long long n0 = 0, d0 = 1, n1 = 1, d1 = 1;
+  for (int k = 0; k < 3; ++k) {
+    if (delta[k] == 0) {
+      if (pa[k] < bounds_.lo[k] || pa[k] > bounds_.hi[k]) return;
+      continue;
+    }
+    long long enter = (delta[k] > 0 ? bounds_.lo[k] : bounds_.hi[k]) - pa[k];
+    long long leave = (delta[k] > 0 ? bounds_.hi[k] : bounds_.lo[k]) - pa[k];
+    long long den = delta[k];
+    if (den < 0) {
+      enter = -enter;
+      leave = -leave;
+      den = -den;
+    }
+    if (enter * d0 > n0 * den) { n0 = enter; d0 = den; }
+    if (leave * d1 < n1 * den) { n1 = leave; d1 = den; }
+    if (n0 * d1 > n1 * d0) return;
+  }
+
+  // Célula do ponto em t0 e, em cada eixo que varia, o próximo cruzamento com um plano da grade como fração
+  // num / den: o plano x = X é cruzado em t = (X - a) / delta
+  int cell[3];
+  long long num[3] = {0, 0, 0}, den[3] = {1, 1, 1};
+  for (int k = 0; k < 3; ++k) {
+    Int128 offset = (Int128)(pa[k] - bounds_.lo[k]) * d0 + (Int128)n0 * delta[k];
+    Int128 c = offset / ((Int128)size_[k] * d0);
+    cell[k] = (int)max((Int128)0, min(c, (Int128)cells_[k] - 1));
+    if (delta[k] == 0) continue;
+    long long plane = bounds_.lo[k] + (cell[k] + (delta[k] > 0)) * size_[k];
+    num[k] = delta[k] > 0 ? plane - pa[k] : pa[k] - plane;
+    den[k] = llabs(delta[k]);
+  }
+
+  for (;;) {
+    size_t id = ((size_t)cell[2] * cells_[1] + cell[1]) * cells_[0] + cell[0];
+    if (stats) stats->nodes_visited++;
+    testRows(a, b, *cache_, packets_, cell_start_[id], cell_start_[id + 1], result, stats);
+
+    // Eixo do cruzamento mais próximo; além de t1 o segmento já saiu da grade
+    int best = -1;
+    for (int k = 0; k < 3; ++k) {
+      if (delta[k] != 0 && (best < 0 || (Int128)num[k] * den[best] < (Int128)num[best] * den[k])) best = k;
+    }
+    if (best < 0 || (Int128)num[best] * d1 > (Int128)n1 * den[best]) return;
+
+    // Cruzamentos simultâneos (por uma aresta ou um canto) avançam todos os eixos juntos: as células ao lado só
+    // são tocadas nesse ponto, que também está na célula seguinte
+    bool tie[3];
+    for (int k = 0; k < 3; ++k) tie[k] = delta[k] != 0 && (Int128)num[k] * den[best] == (Int128)num[best] * den[k];
+    for (int k = 0; k < 3; ++k) {
+      if (!tie[k]) continue;
+      cell[k] += delta[k] > 0 ? 1 : -1;
+      if (cell[k] < 0 || cell[k] >= cells_[k]) return;
+      num[k] += size_[k];
+    }
+  }
+}
+
+size_t GridIndex::bytes() const {
+  return cell_start_.size() * sizeof(size_t) + packetBytes(packets_);
+}
+
+string GridIndex::summary() const {
+  ostringstream out;
+  out << "Grid (cells: " << cells_[0] << "x" << cells_[1] << "x" << cells_[2] << ", references: "
+      << (cell_start_.empty() ? 0 : cell_start_.back()) << ", bytes: " << bytes() << ")";
+  return out.str();
+}
+
+// ======================================================================================================================= //
+
+// Faixas de centroides avaliadas por eixo em cada nó
+const int BVH_BINS = 16;
+
+// Custo de visitar um nó interno, em testes de triângulo
+const double BVH_TRAVERSAL_COST = 1.0;
+
+// Metade da área da superfície de uma caixa
+static double halfArea(const NodeBox& box) {
+  double ex = (double)box.hi[0] - box.lo[0], ey = (double)box.hi[1] - box.lo[1], ez = (double)box.hi[2] - box.lo[2];
+  return ex * ey + ey * ez + ez * ex;
+}
+
+BVHIndex::BVHIndex(SimdLevel simd, int leaf_size, int max_leaf) : simd_(simd), leaf_size_(max(leaf_size, 1)), max_leaf_(max(max_leaf, leaf_size)) {}
+
+void BVHIndex::build(const TriangleCache& cache) {
+  cache_ = &cache;
+  size_t n = cache.size();
+  nodes_.clear();
+
+  vector<int> order(n);
+  iota(order.begin(), order.end(), 0);
+  if (n > 0) {
+    vector<NodeBox> boxes(n);
+    for (size_t i = 0; i < n; ++i) boxes[i] = triangleBox(cache, (int)i);
+    nodes_.reserve(2 * n);
+    nodes_.push_back(BVHNode());
+    buildNode(0, 0, (uint32_t)n, order, boxes);
+  }
+  packets_ = buildTrianglePackets(cache, order, simd_);
+}
+
+// Constrói o nó index sobre order[begin, end). O centroide de um triângulo é o centro da sua caixa, guardado
+// dobrado (lo + hi) para ficar inteiro.
+void BVHIndex::buildNode(uint32_t index, uint32_t begin, uint32_t end, vector<int>& order, const vector<NodeBox>& boxes) {
+  NodeBox box = boxes[order[begin]];
+  long long lo[3] = {LLONG_MAX, LLONG_MAX, LLONG_MAX}, hi[3] = {LLONG_MIN, LLONG_MIN, LLONG_MIN};
+  for (uint32_t i = begin; i < end; ++i) {
+    const NodeBox& tri = boxes[order[i]];
+    growBox(box, tri);
+    for (int k = 0; k < 3; ++k) {
+      long long c = (long long)tri.lo[k] + tri.hi[k];
+      lo[k] = min(lo[k], c);
+      hi[k] = max(hi[k], c);
+    }
+  }
+  nodes_[index].box = box;
+  nodes_[index].first = begin;
+  nodes_[index].count = end - begin;
+
+  uint32_t count = end - begin;
+  if (count <= (uint32_t)leaf_size_) return;
+
+  auto binOf = [&](int axis, int tri) {
+    long long c = (long long)boxes[tri].lo[axis] + boxes[tri].hi[axis];
+    return (int)((c - lo[axis]) * BVH_BINS / (hi[axis] - lo[axis] + 1));
+  };
+
+  // Melhor corte: eixo e primeira faixa do lado direito, pelo custo SAH relativo à área do nó
+  int best_axis = -1, best_bin = 0;
+  double best_cost = INFINITY;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (lo[axis] == hi[axis]) continue;
+    uint32_t bin_count[BVH_BINS] = {};
+    NodeBox bin_box[BVH_BINS];
+    for (uint32_t i = begin; i < end; ++i) {
+      int bin = binOf(axis, order[i]);
+      if (bin_count[bin]++ == 0) bin_box[bin] = boxes[order[i]];
+      else growBox(bin_box[bin], boxes[order[i]]);
+    }
+
+    // Área e contagem acumuladas da direita para a esquerda; depois varre da esquerda
+    double right_area[BVH_BINS];
+    uint32_t right_count[BVH_BINS];
+    NodeBox acc;
+    uint32_t acc_count = 0;
+    for (int bin = BVH_BINS - 1; bin > 0; --bin) {
+      if (bin_count[bin]) {
+        if (acc_count == 0) acc = bin_box[bin];
+        else growBox(acc, bin_box[bin]);
+        acc_count += bin_count[bin];
+      }
+      right_area[bin] = acc_count ? halfArea(acc) : 0;
+      right_count[bin] = acc_count;
+    }
+    acc_count = 0;
+    for (int bin = 1; bin < BVH_BINS; ++bin) {
+      if (bin_count[bin - 1]) {
+        if (acc_count == 0) acc = bin_box[bin - 1];
+        else growBox(acc, bin_box[bin - 1]);
+        acc_count += bin_count[bin - 1];
+      }
+      if (acc_count == 0 || right_count[bin] == 0) continue;
+      double cost = halfArea(acc) * acc_count + right_area[bin] * right_count[bin];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = bin;
+      }
+    }
+  }
+
+  // Todos os centroides iguais: não há corte possível
+  if (best_axis < 0) return;
+  double area = halfArea(box);
+  double split_cost = BVH_TRAVERSAL_COST * area + best_cost;
+  if (split_cost >= area * count && count <= (uint32_t)max_leaf_) return;
+
+  auto middle = partition(order.begin() + begin, order.begin() + end, [&](int tri) { return binOf(best_axis, tri) < best_bin; });
+  uint32_t mid = (uint32_t)(middle - order.begin());
+
+  uint32_t children = (uint32_t)nodes_.size();
+  nodes_[index].first = children;
+  nodes_[index].count = 0;
+  nodes_.push_back(BVHNode());
+  nodes_.push_back(BVHNode());
+  buildNode(children, begin, mid, order, boxes);
+  buildNode(children + 1, mid, end, order, boxes);
+}
+
+void BVHIndex::query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats) const {
+  if (nodes_.empty()) return;
+
+  vector<uint32_t> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+
+  while (!stack.empty()) {
+    const BVHNode& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!segmentIntersectsBox(a, b, node.box)) continue;
+    if (stats) stats->nodes_visited++;
+
+    if (node.count > 0) {
+      testRows(a, b, *cache_, packets_, node.first, node.first + node.count, result, stats);
+      continue;
+    }
+    stack.push_back(node.first + 1);
+    stack.push_back(node.first);
+  }
+}
+
+size_t BVHIndex::bytes() const {
+  return nodes_.size() * sizeof(BVHNode) + packetBytes(packets_);
+}
+
+string BVHIndex::summary() const {
+  size_t leaves = 0, max_leaf = 0;
+  for (const BVHNode& node : nodes_) {
+    leaves += node.count > 0;
+    max_leaf = max(max_leaf, (size_t)node.count);
+  }
+  ostringstream out;
+  out << "BVH (nodes: " << nodes_.size() << ", leaves: " << leaves << ", max leaf: " << max_leaf << ", bytes: " << bytes() << ")";
+  return out.str();
+}
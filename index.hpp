@@ -0,0 +1,211 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include "bsp.hpp"
+#include "packet.hpp"
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Estruturas de aceleração disponíveis.
+ * BSP: a BSP de buildBSP, linearizada. GRID: grade uniforme percorrida com 3D-DDA. BVH: hierarquia de caixas
+ * construída com SAH em faixas.
+ */
+enum class IndexKind { BSP, GRID, BVH };
+
+/**
+ * @param kind Estrutura
+ * @return Nome da estrutura ("bsp", "grid" ou "bvh")
+ */
+const char* indexKindName(IndexKind kind);
+
+/**
+ * Converte o nome de uma estrutura ("bsp", "grid" ou "bvh") para o enum.
+ * @param name Nome da estrutura
+ * @param kind Recebe a estrutura, se o nome for válido
+ * @return false se o nome não corresponde a nenhuma estrutura
+ */
+bool parseIndexKind(const string& name, IndexKind& kind);
+
+// ======================================================================================================================= //
+
+class BSPIndex;
+
+/**
+ * Interface comum das estruturas de aceleração. Todas descartam só o que o segmento certamente não toca e
+ * decidem cada candidato com o teste exato (segmentIntersectsTriangle, ou o teste em pacote equivalente), então
+ * a saída é a mesma em qualquer uma. Depois de build, query só lê a estrutura e pode ser chamada de várias
+ * threads ao mesmo tempo, cada uma com o seu HitSet.
+ */
+class SpatialIndex {
+public:
+  virtual ~SpatialIndex() = default;
+
+  /**
+   * Constrói a estrutura sobre todos os triângulos do cache, descartando a anterior.
+   * @param cache Cache dos triângulos; precisa continuar válido enquanto a estrutura existir
+   */
+  virtual void build(const TriangleCache& cache) = 0;
+
+  /**
+   * Coleta os triângulos intersectados por um segmento.
+   * @param a Ponto inicial do segmento
+   * @param b Ponto final do segmento
+   * @param result Conjunto onde os índices (1-based) dos triângulos intersectados serão inseridos
+   * @param stats Se não nulo, recebe os nós (ou células) visitados e os testes de triângulo
+   */
+  virtual void query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats = nullptr) const = 0;
+
+  /**
+   * @return Bytes ocupados pela estrutura, sem contar o cache dos triângulos
+   */
+  virtual size_t bytes() const = 0;
+
+  /**
+   * @return Resumo de uma linha para o modo verboso
+   */
+  virtual string summary() const = 0;
+
+  /**
+   * @return A própria estrutura, se for uma BSP; QuerySession usa então os percursos próprios da BSP
+   */
+  virtual const BSPIndex* asBSP() const { return nullptr; }
+};
+
+/**
+ * Cria uma estrutura vazia; os parâmetros de construção da BSP só valem para IndexKind::BSP.
+ * @param kind Estrutura
+ * @param options Parâmetros de buildBSP
+ * @param simd Conjunto de instruções do teste em pacote
+ * @return Estrutura pronta para build
+ */
+unique_ptr<SpatialIndex> makeSpatialIndex(IndexKind kind, const BuildOptions& options = BuildOptions(), SimdLevel simd = SimdLevel::AUTO);
+
+// ======================================================================================================================= //
+
+/**
+ * Resumo da última construção de um BSPIndex.
+ * @param tree Forma da árvore de ponteiros, antes da linearização
+ * @param spanning Triângulos SPANNING duplicados ou recortados (BSPTree::spanning)
+ * @param memory Memória usada pela construção
+ * @param flatten_ms Tempo de flattenBSP
+ */
+struct BSPBuildInfo {
+  TreeStats tree;
+  size_t spanning = 0;
+  BuildMemoryStats memory;
+  double flatten_ms = 0;
+};
+
+/**
+ * A BSP de buildBSP como SpatialIndex: constrói a árvore de ponteiros, lineariza e descarta a original.
+ */
+class BSPIndex : public SpatialIndex {
+public:
+  explicit BSPIndex(const BuildOptions& options = BuildOptions(), SimdLevel simd = SimdLevel::AUTO);
+
+  void build(const TriangleCache& cache) override;
+  void query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats = nullptr) const override;
+  size_t bytes() const override;
+  string summary() const override;
+  const BSPIndex* asBSP() const override { return this; }
+
+  const FlatBSP& tree() const { return tree_; }
+  const TrianglePackets& packets() const { return packets_; }
+  const BSPBuildInfo& info() const { return info_; }
+
+private:
+  BuildOptions options_;
+  SimdLevel simd_;
+  const TriangleCache* cache_ = nullptr;
+  FlatBSP tree_;
+  TrianglePackets packets_;
+  BSPBuildInfo info_;
+};
+
+/**
+ * Grade uniforme sobre a caixa dos triângulos. Cada triângulo entra em todas as células (fechadas) que a sua
+ * caixa toca, e a consulta percorre as células do segmento com 3D-DDA exato: os cruzamentos com os planos da
+ * grade são frações inteiras comparadas em 128 bits, então nenhuma célula tocada pelo segmento é pulada.
+ */
+class GridIndex : public SpatialIndex {
+public:
+  /**
+   * @param simd Conjunto de instruções do teste em pacote
+   * @param density Células por triângulo (limitado a MAX_CELLS células no total)
+   */
+  explicit GridIndex(SimdLevel simd = SimdLevel::AUTO, double density = 2.0);
+
+  void build(const TriangleCache& cache) override;
+  void query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats = nullptr) const override;
+  size_t bytes() const override;
+  string summary() const override;
+
+  static const size_t MAX_CELLS = 1 << 24;
+
+private:
+  SimdLevel simd_;
+  double density_;
+  const TriangleCache* cache_ = nullptr;
+  NodeBox bounds_;                  // Caixa de todos os triângulos; a célula c do eixo k começa em lo[k] + c * size_[k]
+  long long size_[3] = {1, 1, 1};   // Lado das células em cada eixo
+  int cells_[3] = {0, 0, 0};        // Células em cada eixo (0 sem triângulos)
+  vector<size_t> cell_start_;       // Células em CSR: os triângulos da célula i são as linhas [cell_start_[i], cell_start_[i + 1])
+  TrianglePackets packets_;         // Linhas na ordem das células
+};
+
+/**
+ * Nó da BVH. Folhas (count > 0) testam as linhas [first, first + count) dos pacotes; nós internos têm os
+ * filhos em first e first + 1.
+ */
+struct BVHNode {
+  NodeBox box;
+  uint32_t first;
+  uint32_t count;
+};
+
+/**
+ * Hierarquia de caixas alinhadas aos eixos, construída de cima para baixo: cada nó escolhe o eixo e o corte
+ * entre faixas de centroides que minimizam o custo SAH, ou vira folha se dividir não compensa.
+ */
+class BVHIndex : public SpatialIndex {
+public:
+  /**
+   * @param simd Conjunto de instruções do teste em pacote
+   * @param leaf_size Nós com até esse número de triângulos viram folha sem avaliar divisões
+   * @param max_leaf Acima desse número o nó é dividido mesmo que o SAH prefira uma folha
+   */
+  explicit BVHIndex(SimdLevel simd = SimdLevel::AUTO, int leaf_size = 4, int max_leaf = 16);
+
+  void build(const TriangleCache& cache) override;
+  void query(const Point3D& a, const Point3D& b, HitSet& result, QueryStats* stats = nullptr) const override;
+  size_t bytes() const override;
+  string summary() const override;
+
+  const vector<BVHNode>& nodes() const { return nodes_; }
+
+private:
+  void buildNode(uint32_t index, uint32_t begin, uint32_t end, vector<int>& order, const vector<NodeBox>& boxes);
+
+  SimdLevel simd_;
+  int leaf_size_;
+  int max_leaf_;
+  const TriangleCache* cache_ = nullptr;
+  vector<BVHNode> nodes_;           // nodes_[0] é a raiz
+  TrianglePackets packets_;         // Linhas na ordem das folhas
+};
+
+#endif // INDEX_HPP
@@ -0,0 +1,197 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "input.hpp"
+#include <charconv>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Tamanho do bloco de leitura para pipes e terminais
+const size_t READ_BLOCK = 1 << 20;
+
+// Nenhum inteiro válido passa disto; tokens maiores são rejeitados
+const size_t MAX_TOKEN = 32;
+
+// ======================================================================================================================= //
+
+InputReader::InputReader(int fd) : fd_(fd) {
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      off_t offset = lseek(fd, 0, SEEK_CUR);
+      data_ = static_cast<const char*>(map);
+      size_ = st.st_size;
+      pos_ = offset > 0 ? offset : 0;
+      mapped_ = true;
+      eof_ = true;
+      return;
+    }
+  }
+  buffer_.resize(READ_BLOCK + MAX_TOKEN);
+  data_ = buffer_.data();
+}
+
+InputReader::~InputReader() {
+  if (mapped_) munmap(const_cast<char*>(data_), size_);
+}
+
+// ======================================================================================================================= //
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// Descarta o que já foi lido e completa a janela com o próximo bloco do descritor
+bool InputReader::refill() {
+  if (eof_) return false;
+
+  size_t rest = size_ - pos_;
+  memmove(buffer_.data(), buffer_.data() + pos_, rest);
+  base_ += pos_;
+  pos_ = 0;
+  size_ = rest;
+
+  while (size_ < buffer_.size()) {
+    ssize_t got = read(fd_, buffer_.data() + size_, buffer_.size() - size_);
+    if (got <= 0) {
+      eof_ = true;
+      break;
+    }
+    size_ += got;
+    // Um token completo já pode ser convertido; esperar mais atrasaria respostas no modo de fluxo
+    if (size_ >= MAX_TOKEN || isSpace(buffer_[size_ - 1])) break;
+  }
+  data_ = buffer_.data();
+  return size_ > rest;
+}
+
+void InputReader::skipSpaces() {
+  while (true) {
+    while (pos_ < size_) {
+      char c = data_[pos_];
+      if (c == '\n') {
+        line_++;
+        line_start_ = base_ + pos_ + 1;
+      } else if (c != ' ' && c != '\t' && c != '\r') {
+        return;
+      }
+      pos_++;
+    }
+    if (!refill()) return;
+  }
+}
+
+bool InputReader::atEnd() {
+  skipSpaces();
+  return pos_ >= size_;
+}
+
+bool InputReader::ready() {
+  while (pos_ < size_ && isSpace(data_[pos_])) {
+    if (data_[pos_] == '\n') {
+      line_++;
+      line_start_ = base_ + pos_ + 1;
+    }
+    pos_++;
+  }
+  return pos_ < size_;
+}
+
+// ======================================================================================================================= //
+
+int InputReader::readInt(const char* what) {
+  skipSpaces();
+
+  // Garante que o token inteiro está na janela antes de converter. Se a janela termina em espaço o token
+  // já está completo, e ler mais bloquearia um pipe à espera do próximo segmento.
+  if (size_ - pos_ < MAX_TOKEN && !(pos_ < size_ && isSpace(data_[size_ - 1]))) refill();
+  token_line_ = line();
+  token_column_ = column();
+  if (pos_ >= size_) throw ParseError(string("fim da entrada; esperava ") + what, token_line_, token_column_);
+
+  int value = 0;
+  const char* first = data_ + pos_;
+  const char* last = data_ + size_;
+  auto [ptr, ec] = from_chars(first, last, value);
+
+  bool separated = ptr == last || *ptr == ' ' || *ptr == '\n' || *ptr == '\t' || *ptr == '\r';
+  if (ec == errc::result_out_of_range) throw ParseError(string("inteiro fora do intervalo em ") + what, token_line_, token_column_);
+  if (ec != errc() || !separated) throw ParseError(string("esperava ") + what, token_line_, token_column_);
+
+  pos_ += ptr - first;
+  return value;
+}
+
+// ======================================================================================================================= //
+
+// Lê uma coordenada e garante |c| < COORD_LIMIT, faixa em que os predicados geométricos são exatos
+static int readCoordinate(InputReader& in, const char* what) {
+  int value = in.readInt(what);
+  if (value <= -COORD_LIMIT || value >= COORD_LIMIT)
+    throw ParseError(string(what) + " fora do intervalo suportado (|c| < 2^30)", in.tokenLine(), in.tokenColumn());
+  return value;
+}
+
+Segment readSegment(InputReader& in) {
+  int c[6];
+  for (int k = 0; k < 6; ++k) c[k] = readCoordinate(in, "coordenada de segmento");
+  return Segment(c[0], c[1], c[2], c[3], c[4], c[5]);
+}
+
+BSPData readInput(int fd) {
+  InputReader in(fd);
+  return readInput(in);
+}
+
+BSPData readInput(InputReader& in) {
+  BSPData data;
+
+  int n = in.readInt("o número de pontos");
+  int t = in.readInt("o número de triângulos");
+  int l = in.readInt("o número de segmentos");
+  if (n < 0 || t < 0 || l < 0) throw ParseError("contagens do cabeçalho não podem ser negativas", in.tokenLine(), in.tokenColumn());
+
+  // Cada inteiro ocupa ao menos um dígito e um separador: mais registros que isso não cabem no que já foi
+  // recebido, e o restante (se vier de um pipe) cresce conforme é lido
+  size_t available = in.buffered();
+  data.points.reserve(min((size_t)n, available / 6));
+  data.triangles.reserve(min((size_t)t, available / 6));
+  data.segments.reserve(min((size_t)l, available / 12));
+
+  // Lê os pontos
+  for (int i = 0; i < n; ++i) {
+    int x = readCoordinate(in, "coordenada de ponto");
+    int y = readCoordinate(in, "coordenada de ponto");
+    int z = readCoordinate(in, "coordenada de ponto");
+    data.points.emplace_back(x, y, z);
+  }
+
+  // Lê os triângulos; os índices são usados sem verificação nas rotinas da BSP
+  for (int i = 0; i < t; ++i) {
+    int v[3];
+    for (int k = 0; k < 3; ++k) {
+      v[k] = in.readInt("índice de vértice");
+      if (v[k] < 1 || v[k] > n) throw ParseError("índice de vértice fora de [1, " + to_string(n) + "]", in.tokenLine(), in.tokenColumn());
+    }
+    data.triangles.emplace_back(v[0], v[1], v[2]);
+  }
+
+  // Lê os segmentos
+  for (int i = 0; i < l; ++i) data.segments.push_back(readSegment(in));
+
+  return data;
+}
@@ -0,0 +1,138 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+#include "bsp.hpp"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Erro de leitura da entrada, com a posição (1-based) onde ocorreu.
+ */
+struct ParseError : runtime_error {
+  size_t line, column;
+
+  ParseError(const string& message, size_t line, size_t column)
+    : runtime_error("linha " + to_string(line) + ", coluna " + to_string(column) + ": " + message),
+      line(line), column(column) {}
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Leitor de inteiros de alto desempenho sobre um descritor de arquivo.
+ * Arquivos regulares são mapeados em memória (mmap); pipes e terminais são lidos em blocos grandes.
+ * Os inteiros são convertidos com std::from_chars, sem passar por iostream.
+ */
+class InputReader {
+public:
+  /**
+   * @param fd Descritor de onde ler (0 para a entrada padrão)
+   */
+  explicit InputReader(int fd);
+  ~InputReader();
+
+  InputReader(const InputReader&) = delete;
+  InputReader& operator=(const InputReader&) = delete;
+
+  /**
+   * Lê o próximo inteiro.
+   * @param what Descrição do valor esperado, usada na mensagem de erro
+   * @return O inteiro lido
+   * @throws ParseError se a entrada terminar ou o próximo token não for um inteiro válido
+   */
+  int readInt(const char* what);
+
+  /**
+   * Pula espaços em branco e informa se a entrada terminou.
+   * @return true se não há mais tokens
+   */
+  bool atEnd();
+
+  /**
+   * Pula os espaços já disponíveis e informa se há um token na janela, sem esperar pelo descritor.
+   * No modo de fluxo, indica se o próximo segmento pode ser lido sem bloquear.
+   * @return true se o próximo token já foi recebido
+   */
+  bool ready();
+
+  /**
+   * Bytes já disponíveis a partir da posição atual: o resto do arquivo, quando mapeado, ou o resto da janela.
+   */
+  size_t buffered() const { return size_ - pos_; }
+
+  /**
+   * Posição atual (1-based) na entrada, para mensagens de erro.
+   */
+  size_t line() const { return line_; }
+  size_t column() const { return base_ + pos_ - line_start_ + 1; }
+
+  /**
+   * Posição (1-based) do início do último token lido por readInt.
+   */
+  size_t tokenLine() const { return token_line_; }
+  size_t tokenColumn() const { return token_column_; }
+
+private:
+  void skipSpaces();
+  bool refill();
+
+  int fd_;
+  const char* data_ = nullptr;   // Início da janela atual (mapeamento ou buffer)
+  size_t size_ = 0;              // Bytes válidos na janela
+  size_t pos_ = 0;               // Posição de leitura dentro da janela
+  size_t base_ = 0;              // Deslocamento absoluto do início da janela
+  size_t line_ = 1;              // Linha atual
+  size_t line_start_ = 0;        // Deslocamento absoluto do início da linha atual
+  bool mapped_ = false;          // A janela é um mmap do arquivo inteiro
+  bool eof_ = false;             // Não há mais nada para ler do descritor
+  size_t token_line_ = 1;        // Posição do último token lido
+  size_t token_column_ = 1;
+  vector<char> buffer_;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Lê a entrada no formato texto (cabeçalho n t l, pontos, triângulos e segmentos).
+ * Os vetores de BSPData são reservados a partir do cabeçalho, até o que os bytes já disponíveis comportam (um
+ * cabeçalho maior que a entrada não aloca nada além disso); índices de vértices fora de [1, n] e
+ * coordenadas com módulo a partir de COORD_LIMIT são rejeitados.
+ * @param fd Descritor de onde ler (0 para a entrada padrão)
+ * @return Dados lidos
+ * @throws ParseError se a entrada estiver malformada
+ */
+BSPData readInput(int fd = 0);
+
+/**
+ * Igual à versão anterior, lendo de um leitor já aberto. O leitor fica posicionado logo depois do último
+ * segmento do cabeçalho, para que o modo de fluxo continue lendo segmentos dele.
+ * @param in Leitor da entrada
+ * @return Dados lidos
+ * @throws ParseError se a entrada estiver malformada
+ */
+BSPData readInput(InputReader& in);
+
+/**
+ * Lê um segmento (seis coordenadas) no formato texto.
+ * @param in Leitor da entrada
+ * @return Segmento lido
+ * @throws ParseError se a entrada terminar no meio do segmento ou uma coordenada for inválida
+ */
+Segment readSegment(InputReader& in);
+
+#endif // INPUT_HPP
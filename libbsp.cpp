@@ -0,0 +1,63 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "libbsp.hpp"
+#include <stdexcept>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+// Os predicados geométricos só são exatos com |coord| < COORD_LIMIT
+static bool inRange(const Point3D& p) {
+  return abs((long long)p.x) < COORD_LIMIT && abs((long long)p.y) < COORD_LIMIT && abs((long long)p.z) < COORD_LIMIT;
+}
+
+void checkSegments(Span<Segment> segments) {
+  for (const Segment& seg : segments) {
+    if (!inRange(seg.p1) || !inRange(seg.p2)) throw runtime_error("coordenada de segmento fora do intervalo suportado");
+  }
+}
+
+// ======================================================================================================================= //
+
+BSPMesh::BSPMesh(Span<Point3D> points, Span<Triangle> triangles, const MeshOptions& options) {
+  for (const Point3D& p : points) {
+    if (!inRange(p)) throw runtime_error("coordenada de ponto fora do intervalo suportado");
+  }
+
+  // As rotinas da BSP indexam os pontos sem verificação
+  long long n = points.size();
+  for (const Triangle& tri : triangles) {
+    if (tri.a < 1 || tri.a > n || tri.b < 1 || tri.b > n || tri.c < 1 || tri.c > n)
+      throw runtime_error("triângulo com índice de vértice inválido");
+  }
+
+  cache_ = make_unique<TriangleCache>(options.compact ? buildTriangleCache(compactMesh(triangles, points))
+                                                      : buildTriangleCache(triangles, points));
+  index_ = makeSpatialIndex(options.index, options.build, options.simd);
+  index_->build(*cache_);
+}
+
+BSPMesh::~BSPMesh() = default;
+BSPMesh::BSPMesh(BSPMesh&&) noexcept = default;
+BSPMesh& BSPMesh::operator=(BSPMesh&&) noexcept = default;
+
+QueryResults BSPMesh::query(Span<Segment> segments, const QueryOptions& options) const {
+  checkSegments(segments);
+  QueryResults results;
+  QuerySession(*cache_, *index_, options).run(segments, results);
+  return results;
+}
+
+unique_ptr<QuerySession> BSPMesh::session(const QueryOptions& options) const {
+  return make_unique<QuerySession>(*cache_, *index_, options);
+}
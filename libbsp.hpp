@@ -0,0 +1,90 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef LIBBSP_HPP
+#define LIBBSP_HPP
+
+#include "bsp.hpp"
+#include "index.hpp"
+#include "mesh.hpp"
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Parâmetros de construção de um BSPMesh.
+ * @param index Estrutura de aceleração
+ * @param build Parâmetros de buildBSP (build.threads vale para a construção da BSP)
+ * @param simd Conjunto de instruções do teste em pacote
+ * @param compact Constrói sobre a malha compacta (ver CompactMesh); os resultados continuam nos índices da entrada
+ */
+struct MeshOptions {
+  IndexKind index = IndexKind::BSP;
+  BuildOptions build;
+  SimdLevel simd = SimdLevel::AUTO;
+  bool compact = false;
+};
+
+/**
+ * Ponto de entrada para quem usa a biblioteca (libbsp) sem passar pelo executável: recebe a malha em spans,
+ * copia o que as consultas precisam e constrói a estrutura uma vez. Depois disso o objeto só é lido, então
+ * várias threads podem consultá-lo ao mesmo tempo, cada uma com a sua chamada a query ou a sua sessão.
+ */
+class BSPMesh {
+public:
+  /**
+   * Valida a malha e constrói a estrutura. Os spans podem ser descartados depois da chamada.
+   * @param points Vértices, com |coord| < COORD_LIMIT
+   * @param triangles Triângulos, com índices 1-based em points
+   * @param options Estrutura e parâmetros de construção
+   * @throws runtime_error se uma coordenada está fora do intervalo ou um índice não existe
+   */
+  BSPMesh(Span<Point3D> points, Span<Triangle> triangles, const MeshOptions& options = MeshOptions());
+  ~BSPMesh();
+
+  BSPMesh(BSPMesh&&) noexcept;
+  BSPMesh& operator=(BSPMesh&&) noexcept;
+
+  /**
+   * Responde um lote de segmentos com uma sessão criada só para a chamada. Pode ser chamada de várias
+   * threads ao mesmo tempo; para muitos lotes pequenos, session evita montar o estado a cada chamada.
+   * @param segments Segmentos, com |coord| < COORD_LIMIT
+   * @param options Threads e modo de percurso; o conjunto de instruções é o de MeshOptions, usado na construção
+   * @return Índices (1-based, da entrada) dos triângulos intersectados por cada segmento
+   * @throws runtime_error se uma coordenada está fora do intervalo
+   */
+  QueryResults query(Span<Segment> segments, const QueryOptions& options = QueryOptions()) const;
+
+  /**
+   * Sessão reaproveitável sobre o objeto, para uma thread que responde vários lotes. A sessão não valida
+   * os segmentos (ver checkSegments) e precisa ser destruída antes do BSPMesh.
+   * @param options Threads e modo de percurso
+   * @return Sessão pronta para run
+   */
+  unique_ptr<QuerySession> session(const QueryOptions& options = QueryOptions()) const;
+
+  size_t triangles() const { return cache_->size(); }
+  const SpatialIndex& index() const { return *index_; }
+
+private:
+  unique_ptr<TriangleCache> cache_;   // Em um ponteiro para o endereço sobreviver à movimentação do objeto
+  unique_ptr<SpatialIndex> index_;
+};
+
+/**
+ * Verifica se as coordenadas dos segmentos estão dentro do intervalo dos predicados exatos.
+ * @param segments Segmentos
+ * @throws runtime_error na primeira coordenada fora do intervalo
+ */
+void checkSegments(Span<Segment> segments);
+
+#endif // LIBBSP_HPP
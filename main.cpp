@@ -10,71 +10,421 @@
  ************************************************************************/
 
 #include "bsp.hpp"
+#include "input.hpp"
+#include "binary.hpp"
+#include "packet.hpp"
+#include "index.hpp"
+#include "mesh.hpp"
 #include <iostream>
 #include <string>
+#include <charconv>
+#include <cstdio>
+#include <chrono>
 
 using namespace std;
 
-// Função para ler os dados da entrada padrão
-BSPData readInput() {
-  BSPData data;
-  int n, t, l;
-  cin >> n >> t >> l;
+// Modos de leitura dos segmentos depois da construção (--stream)
+enum class StreamMode { NONE, TEXT, BINARY };
+
+// Lote padrão do modo de fluxo: limita o trabalho, e portanto a latência, entre duas descargas da saída
+const size_t STREAM_BATCH = 1024;
+
+// Imprime uma linha por segmento ("n i1 i2 ... in") direto do buffer de resultados, formatando com to_chars
+// em blocos de 1 MiB
+void printResults(const QueryResults& results) {
+  const size_t block = 1 << 20;
+  const size_t line_max = 32; // Maior número mais separador
+  static vector<char> buffer(block + line_max); // Reaproveitado entre os lotes do modo de fluxo
+  size_t used = 0;
+
+  auto put = [&](size_t value, char end) {
+    char* pos = buffer.data() + used;
+    pos = to_chars(pos, pos + line_max - 1, value).ptr;
+    *pos++ = end;
+    used = pos - buffer.data();
+    if (used >= block) {
+      fwrite(buffer.data(), 1, used, stdout);
+      used = 0;
+    }
+  };
 
-  // Lê os pontos
-  for (int i = 0; i < n; ++i) {
-    int x, y, z;
-    cin >> x >> y >> z;
-    data.points.emplace_back(x, y, z);
+  // O modo verboso escreve em cout antes; a saída precisa vir depois
+  cout.flush();
+  for (size_t i = 0; i < results.size(); ++i) {
+    Span<int> ids = results[i];
+    put(ids.size(), ids.empty() ? '\n' : ' ');
+    for (size_t k = 0; k < ids.size(); ++k) put(ids[k], k + 1 == ids.size() ? '\n' : ' ');
   }
+  fwrite(buffer.data(), 1, used, stdout);
+  fflush(stdout);
+}
+
+// Medidas da execução para --stats, além das que a sessão de consultas acumula
+struct RunStats {
+  IndexKind index = IndexKind::BSP;
+  double read_ms = 0;
+  double build_ms = 0;         // Cache dos triângulos e construção da estrutura (com a linearização, na BSP)
+  double flatten_ms = 0;
+  bool built = false;          // Falso com --load-tree: não há construção a medir
+  size_t bytes = 0;            // Bytes da estrutura construída
+  TreeStats tree;              // Só na BSP
+  size_t spanning = 0;
+  BuildMemoryStats memory;
+};
+
+static double elapsedMs(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
 
-  // Lê os triângulos
-  for (int i = 0; i < t; ++i) {
-    int a, b, c;
-    cin >> a >> b >> c;
-    data.triangles.emplace_back(a, b, c);
+// Escreve as medidas de --stats como um objeto JSON
+void writeStats(FILE* out, const RunStats& run, const QueryStats& query) {
+  fprintf(out, "{\n  \"index\": \"%s\",\n", indexKindName(run.index));
+  fprintf(out, "  \"timings_ms\": {\"read\": %.3f, \"build\": %.3f, \"flatten\": %.3f, \"query\": %.3f},\n",
+          run.read_ms, run.build_ms, run.flatten_ms, query.query_ms);
+
+  if (run.built && run.index != IndexKind::BSP) {
+    fprintf(out, "  \"build\": {\"bytes\": %zu},\n", run.bytes);
+  } else if (run.built) {
+    const TreeStats& tree = run.tree;
+    fprintf(out, "  \"build\": {\"nodes\": %d, \"leaves\": %d, \"max_depth\": %d, \"average_depth\": %.3f, "
+            "\"max_bucket\": %d, \"spanning\": %zu, \"peak_bytes\": %zu, \"allocations\": %zu, \"bytes\": %zu},\n",
+            tree.nodes, tree.leaves, tree.depth, tree.nodes ? (double)tree.depth_sum / tree.nodes : 0.0, tree.max_bucket,
+            run.spanning, run.memory.peak_bytes, run.memory.allocations, run.bytes);
+  } else {
+    fprintf(out, "  \"build\": null,\n");
   }
 
-  // Lê os segmentos
-  for (int i = 0; i < l; ++i) {
-    int xa, ya, za, xb, yb, zb;
-    cin >> xa >> ya >> za >> xb >> yb >> zb;
-    data.segments.emplace_back(xa, ya, za, xb, yb, zb);
+  // O histograma vai até a última faixa não vazia; cada faixa diz o intervalo de nós que cobre
+  int bins = QueryStats::HISTOGRAM_BINS;
+  while (bins > 1 && query.visit_histogram[bins - 1] == 0) --bins;
+  auto ratio = [](size_t part, size_t total) { return total ? (double)part / total : 0.0; };
+  fprintf(out, "  \"query\": {\"segments\": %zu, \"nodes_visited\": %zu, \"average_nodes_visited\": %.3f,\n    \"visit_histogram\": [",
+          query.segments, query.nodes_visited, ratio(query.nodes_visited, query.segments));
+  for (int k = 0; k < bins; ++k) {
+    size_t lo = k ? 1ULL << (k - 1) : 0, hi = k ? (1ULL << k) - 1 : 0;
+    fprintf(out, "%s{\"min\": %zu, \"max\": %zu, \"segments\": %zu}", k ? ", " : "", lo, hi, query.visit_histogram[k]);
   }
+  fprintf(out, "],\n    \"triangle_tests\": %zu, \"hits\": %zu, \"hit_rate\": %.6f, \"parallel_tests\": %zu, "
+          "\"coplanar_tests\": %zu, \"coplanar_rate\": %.6f}\n}\n",
+          query.triangle_tests, query.hits, ratio(query.hits, query.triangle_tests), query.parallel_tests,
+          query.coplanar_tests, ratio(query.coplanar_tests, query.triangle_tests));
+}
 
-  return data;
+// Grava as medidas em path, ou na saída de erro se path é vazio, para não misturar com os resultados
+int reportStats(const string& path, const RunStats& run, const QueryStats& query) {
+  if (path.empty()) {
+    writeStats(stderr, run, query);
+    return 0;
+  }
+  FILE* out = fopen(path.c_str(), "w");
+  if (!out) {
+    cerr << "Erro: não foi possível criar " << path << "\n";
+    return 1;
+  }
+  writeStats(out, run, query);
+  fclose(out);
+  return 0;
+}
+
+// Modo de fluxo: responde os segmentos que chegam depois da malha, em lotes de até batch_size. Um lote
+// termina quando enche ou quando não há mais segmentos já recebidos, e a saída é descarregada ao fim de cada um.
+int streamSegments(QuerySession& session, StreamMode mode, InputReader* text_reader, size_t batch_size) {
+  vector<Segment> batch;
+  QueryResults results;
+  batch.reserve(batch_size);
+
+  try {
+    if (mode == StreamMode::BINARY) {
+      SegmentBatchReader reader(0);
+      while (reader.next(batch, batch_size)) {
+        session.run(batch, results);
+        printResults(results);
+      }
+      return 0;
+    }
+
+    unique_ptr<InputReader> own_reader;
+    if (!text_reader) {
+      own_reader = make_unique<InputReader>(0);
+      text_reader = own_reader.get();
+    }
+    InputReader& in = *text_reader;
+    while (!in.atEnd()) { // Bloqueia até o próximo segmento ou o fim da entrada
+      batch.clear();
+      do {
+        batch.push_back(readSegment(in));
+      } while (batch.size() < batch_size && in.ready());
+      session.run(batch, results);
+      printResults(results);
+    }
+  } catch (const ParseError& e) {
+    cerr << "Entrada inválida: " << e.what() << "\n";
+    return 1;
+  } catch (const runtime_error& e) {
+    cerr << "Erro: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// Converte o valor numérico de uma flag com from_chars: o texto inteiro precisa ser um número a partir de minimum
+template <typename T>
+static bool parseFlagValue(const string& text, T& value, T minimum) {
+  const char* last = text.data() + text.size();
+  auto [ptr, ec] = from_chars(text.data(), last, value);
+  return ec == errc() && ptr == last && value >= minimum;
+}
+
+static int invalidFlagValue(const char* flag) {
+  cerr << "Erro: valor inválido para " << flag << "\n";
+  return 1;
+}
+
+// Subcomando convert: lê a entrada texto da entrada padrão e grava o formato binário
+int convertToBinary(const string& path) {
+  try {
+    writeBinary(path, readInput());
+  } catch (const ParseError& e) {
+    cerr << "Entrada inválida: " << e.what() << "\n";
+    return 1;
+  } catch (const runtime_error& e) {
+    cerr << "Erro: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
 }
 
 int main(int argc, char *argv[]) {
+  if (argc >= 2 && string(argv[1]) == "convert") {
+    if (argc != 3) {
+      cerr << "Uso: " << argv[0] << " convert <saida.bin> < entrada.in\n";
+      return 1;
+    }
+    return convertToBinary(argv[2]);
+  }
+
   bool verbose = false;
+  int threads = 1;
+  string binary_path;
+  string save_tree_path, load_tree_path;
+  StreamMode stream_mode = StreamMode::NONE;
+  size_t batch_size = STREAM_BATCH;
+  bool stats = false;
+  bool compact = false;
+  string stats_path;
+  RunStats run_stats;
+  IndexKind index_kind = IndexKind::BSP;
+  BuildOptions options;
+  QueryOptions query_options;
+
   // Processa argumentos de linha de comando
   for (int i = 1; i < argc; ++i) {
     string arg = argv[i];
     if (arg == "-v" || arg == "--verbose") {
       verbose = true;
+    } else if (arg.rfind("--split=", 0) == 0) {
+      if (!parseSplitStrategy(arg.substr(8), options.strategy)) {
+        cerr << "Estratégia de divisão inválida: " << arg.substr(8) << " (use first, random, balanced ou sah)\n";
+        return 1;
+      }
+    } else if (arg == "--split-spanning") {
+      options.split_spanning = true;
+    } else if (arg.rfind("--candidates=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(13), options.candidates, 0)) return invalidFlagValue("--candidates");
+    } else if (arg.rfind("--seed=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(7), options.seed, 0ULL)) return invalidFlagValue("--seed");
+    } else if (arg.rfind("--leaf-size=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(12), options.leaf_size, INT_MIN)) return invalidFlagValue("--leaf-size");
+    } else if (arg.rfind("--max-depth=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(12), options.max_depth, INT_MIN)) return invalidFlagValue("--max-depth");
+    } else if (arg.rfind("--min-triangles=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(16), options.min_triangles, INT_MIN)) return invalidFlagValue("--min-triangles");
+    } else if (arg.rfind("--simd=", 0) == 0) {
+      if (!parseSimdLevel(arg.substr(7), query_options.simd)) {
+        cerr << "Conjunto de instruções inválido: " << arg.substr(7) << " (use auto, scalar, sse4 ou avx2)\n";
+        return 1;
+      }
+    } else if (arg == "--clip") {
+      query_options.clip = true;
+    } else if (arg == "--any-hit") {
+      query_options.any_hit = true;
+    } else if (arg == "--coherent") {
+      query_options.coherent = true;
+    } else if (arg.rfind("--threads=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(10), threads, 0)) return invalidFlagValue("--threads");
+    } else if (arg.rfind("--binary=", 0) == 0) {
+      binary_path = arg.substr(9);
+    } else if (arg.rfind("--save-tree=", 0) == 0) {
+      save_tree_path = arg.substr(12);
+    } else if (arg.rfind("--load-tree=", 0) == 0) {
+      load_tree_path = arg.substr(12);
+    } else if (arg == "--stream" || arg == "--stream=text") {
+      stream_mode = StreamMode::TEXT;
+    } else if (arg == "--stream=binary") {
+      stream_mode = StreamMode::BINARY;
+    } else if (arg.rfind("--batch=", 0) == 0) {
+      if (!parseFlagValue(arg.substr(8), batch_size, (size_t)0)) return invalidFlagValue("--batch");
+      batch_size = max(batch_size, (size_t)1);
+    } else if (arg.rfind("--index=", 0) == 0) {
+      if (!parseIndexKind(arg.substr(8), index_kind)) {
+        cerr << "Estrutura de aceleração inválida: " << arg.substr(8) << " (use bsp, grid ou bvh)\n";
+        return 1;
+      }
+    } else if (arg == "--compact") {
+      compact = true;
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if (arg.rfind("--stats=", 0) == 0) {
+      stats = true;
+      stats_path = arg.substr(8);
     }
   }
 
-  BSPData data = readInput();
+  // Só a BSP tem formato em disco
+  if (index_kind != IndexKind::BSP && (!save_tree_path.empty() || !load_tree_path.empty())) {
+    cerr << "Erro: --save-tree e --load-tree exigem --index=bsp\n";
+    return 1;
+  }
+
+  // A árvore em disco guarda índices da malha da entrada, não da reordenada
+  if (compact && (!save_tree_path.empty() || !load_tree_path.empty())) {
+    cerr << "Erro: --compact não pode ser usado com --save-tree ou --load-tree\n";
+    return 1;
+  }
+
+  // Lotes binários ocupam a entrada padrão inteira; a malha precisa vir de um arquivo
+  if (stream_mode == StreamMode::BINARY && binary_path.empty()) {
+    cerr << "Erro: --stream=binary exige a malha em --binary=arquivo\n";
+    return 1;
+  }
+
+  // Os dados vêm do texto na entrada padrão (copiados para data) ou de um arquivo binário mapeado.
+  // No modo de fluxo o leitor continua aberto: os segmentos seguintes vêm dele.
+  BSPData data;
+  unique_ptr<MappedBinary> mapped;
+  unique_ptr<InputReader> reader;
+  BSPDataView view;
+  auto start = chrono::steady_clock::now();
+  try {
+    if (!binary_path.empty()) {
+      mapped = make_unique<MappedBinary>(binary_path);
+      view = mapped->view();
+    } else {
+      reader = make_unique<InputReader>(0);
+      data = readInput(*reader);
+      view = data;
+    }
+  } catch (const ParseError& e) {
+    cerr << "Entrada inválida: " << e.what() << "\n";
+    return 1;
+  } catch (const runtime_error& e) {
+    cerr << "Erro: " << e.what() << "\n";
+    return 1;
+  }
+  if (stats) run_stats.read_ms = elapsedMs(start);
 
   if (verbose) {
     // Imprime os dados lidos de forma resumida ou detalhada
-    data.printPoints();
-    data.printTriangles();
-    data.printSegments();
+    view.printPoints();
+    view.printTriangles();
+    view.printSegments();
   }
 
-  // Processa os segmentos e obtém os triângulos interceptados
-  vector<vector<int>> results = processSegments(data);
+  // Vértices, arestas e planos dos triângulos, lidos tanto pela construção quanto pelas consultas
+  // Com --compact o cache segue a malha soldada e reordenada, e os resultados voltam aos índices da entrada
+  start = chrono::steady_clock::now();
+  TriangleCache cache;
+  if (compact) {
+    CompactMesh mesh = compactMesh(view.triangles, view.points);
+    if (verbose) {
+      cout << "Compact mesh (vertices: " << mesh.input_points << " -> " << mesh.points.size()
+           << ", index bits: " << (mesh.indices32.empty() ? 16 : 32) << ", bytes: " << mesh.bytes() << ")\n";
+    }
+    cache = buildTriangleCache(mesh);
+  } else {
+    cache = buildTriangleCache(view.triangles, view.points);
+  }
 
-  // Imprime a saída conforme especificado
-  for (const auto& tri_list : results) {
-    cout << tri_list.size();
-    for (int idx : tri_list) {
-      cout << " " << idx;
+  // Com --load-tree a construção é pulada e a árvore é usada direto do arquivo mapeado
+  unique_ptr<SpatialIndex> index;
+  unique_ptr<MappedTree> mapped_tree;
+  FlatBSPView tree_view;
+
+  if (!load_tree_path.empty()) {
+    try {
+      mapped_tree = make_unique<MappedTree>(load_tree_path, view);
+    } catch (const runtime_error& e) {
+      cerr << "Erro: " << e.what() << "\n";
+      return 1;
+    }
+    tree_view = mapped_tree->view();
+  } else {
+    options.threads = threads;
+    if (index_kind == IndexKind::BSP && options.split_spanning && !canSplitExactly(cache)) {
+      cerr << "Aviso: coordenadas grandes demais para recorte exato; triângulos SPANNING serão duplicados\n";
+    }
+
+    // Constrói a estrutura escolhida; a BSP usa a estratégia de divisão escolhida e já sai linearizada
+    index = makeSpatialIndex(index_kind, options, query_options.simd);
+    index->build(cache);
+    const BSPIndex* bsp = index->asBSP();
+
+    if (stats) {
+      run_stats.build_ms = elapsedMs(start);
+      run_stats.built = true;
+      run_stats.bytes = index->bytes();
+      if (bsp) {
+        run_stats.flatten_ms = bsp->info().flatten_ms;
+        run_stats.tree = bsp->info().tree;
+        run_stats.spanning = bsp->info().spanning;
+        run_stats.memory = bsp->info().memory;
+      }
     }
-    cout << "\n";
+
+    if (verbose) {
+      cout << index->summary() << "\n";
+      if (bsp) {
+        const BuildMemoryStats& memory = bsp->info().memory;
+        cout << "Build memory (peak bytes: " << memory.peak_bytes << ", allocations: " << memory.allocations
+             << ", tree bytes: " << memory.tree_bytes << ")\n";
+      }
+    }
+
+    if (bsp) tree_view = bsp->tree();
   }
-  
-  return 0;
+  run_stats.index = index_kind;
+
+  if (verbose) {
+    if (index_kind == IndexKind::BSP) {
+      cout << "Flat BSP (bytes: " << tree_view.nodes.size() * sizeof(FlatNode) << ", leaf triangles: " << tree_view.leaf_triangles.size() << ")\n";
+    }
+    cout << "SIMD (" << simdLevelName(resolveSimdLevel(query_options.simd)) << ")\n";
+  }
+
+  if (!save_tree_path.empty()) {
+    try {
+      writeTree(save_tree_path, tree_view, view);
+    } catch (const runtime_error& e) {
+      cerr << "Erro: " << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  // Processa os segmentos e obtém os triângulos interceptados
+  query_options.threads = threads;
+  query_options.stats = stats;
+  unique_ptr<QuerySession> session = index ? make_unique<QuerySession>(cache, *index, query_options)
+                                            : make_unique<QuerySession>(cache, tree_view, query_options);
+  QueryResults results;
+  session->run(view.segments, results);
+
+  // Imprime a saída conforme especificado
+  printResults(results);
+
+  // Os segmentos do cabeçalho já foram respondidos; os demais chegam pela entrada padrão
+  int status = 0;
+  if (stream_mode != StreamMode::NONE) status = streamSegments(*session, stream_mode, reader.get(), batch_size);
+
+  if (stats && reportStats(stats_path, run_stats, session->stats()) != 0) return 1;
+  return status;
 }
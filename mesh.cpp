@@ -0,0 +1,105 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "mesh.hpp"
+#include <array>
+#include <numeric>
+#include <tuple>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+size_t CompactMesh::bytes() const {
+  return points.size() * sizeof(Point3D) + indices16.size() * sizeof(uint16_t) + indices32.size() * sizeof(uint32_t) +
+         original.size() * sizeof(int);
+}
+
+// Ordem dos triângulos pelo código de Morton do centroide, guardado triplicado (soma dos vértices) para ficar inteiro
+static vector<int> mortonOrder(Span<Triangle> triangles, Span<Point3D> points) {
+  size_t n = triangles.size();
+  vector<array<long long, 3>> centroids(n);
+  long long lo[3] = {LLONG_MAX, LLONG_MAX, LLONG_MAX}, hi[3] = {LLONG_MIN, LLONG_MIN, LLONG_MIN};
+  for (size_t i = 0; i < n; ++i) {
+    const Point3D& a = points[triangles[i].a - 1];
+    const Point3D& b = points[triangles[i].b - 1];
+    const Point3D& c = points[triangles[i].c - 1];
+    centroids[i] = {(long long)a.x + b.x + c.x, (long long)a.y + b.y + c.y, (long long)a.z + b.z + c.z};
+    for (int k = 0; k < 3; ++k) {
+      lo[k] = min(lo[k], centroids[i][k]);
+      hi[k] = max(hi[k], centroids[i][k]);
+    }
+  }
+
+  vector<pair<uint64_t, int>> codes(n);
+  for (size_t i = 0; i < n; ++i) codes[i] = {mortonCode(centroids[i].data(), lo, hi), (int)i};
+  sort(codes.begin(), codes.end());
+
+  vector<int> order(n);
+  for (size_t i = 0; i < n; ++i) order[i] = codes[i].second;
+  return order;
+}
+
+CompactMesh compactMesh(Span<Triangle> triangles, Span<Point3D> points, bool reorder) {
+  CompactMesh mesh;
+  mesh.input_points = points.size();
+  if (reorder) {
+    mesh.original = mortonOrder(triangles, points);
+  } else {
+    mesh.original.resize(triangles.size());
+    iota(mesh.original.begin(), mesh.original.end(), 0);
+  }
+
+  // Vértice canônico de cada ponto: pontos iguais apontam para o de menor índice entre eles
+  vector<int> sorted(points.size());
+  iota(sorted.begin(), sorted.end(), 0);
+  auto key = [&](int i) { return make_tuple(points[i].x, points[i].y, points[i].z, i); };
+  sort(sorted.begin(), sorted.end(), [&](int i, int j) { return key(i) < key(j); });
+  vector<int> canonical(points.size());
+  for (size_t k = 0; k < sorted.size(); ++k) {
+    int i = sorted[k];
+    const Point3D& p = points[i];
+    bool repeated = k > 0 && p.x == points[sorted[k - 1]].x && p.y == points[sorted[k - 1]].y && p.z == points[sorted[k - 1]].z;
+    canonical[i] = repeated ? canonical[sorted[k - 1]] : i;
+  }
+
+  // Numeração final na ordem do primeiro uso, percorrendo os triângulos já na ordem da malha
+  vector<int> remap(points.size(), -1);
+  vector<uint32_t> indices;
+  indices.reserve(3 * triangles.size());
+  for (int t : mesh.original) {
+    const Triangle& tri = triangles[t];
+    for (int v : {tri.a, tri.b, tri.c}) {
+      int c = canonical[v - 1];
+      if (remap[c] < 0) {
+        remap[c] = (int)mesh.points.size();
+        mesh.points.push_back(points[c]);
+      }
+      indices.push_back(remap[c]);
+    }
+  }
+
+  if (mesh.points.size() <= 65536) mesh.indices16.assign(indices.begin(), indices.end());
+  else mesh.indices32 = move(indices);
+  return mesh;
+}
+
+TriangleCache buildTriangleCache(const CompactMesh& mesh) {
+  TriangleCache cache;
+  reserveTriangleCache(cache, mesh.size());
+  for (size_t i = 0; i < mesh.size(); ++i) appendTriangle(cache, mesh.vertex(i, 0), mesh.vertex(i, 1), mesh.vertex(i, 2));
+
+  // Na ordem da entrada o mapa seria a identidade; vazio, as consultas pulam a tradução
+  bool identity = true;
+  for (size_t i = 0; i < mesh.size() && identity; ++i) identity = mesh.original[i] == (int)i;
+  if (!identity) cache.original = mesh.original;
+  return cache;
+}
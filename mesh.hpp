@@ -0,0 +1,66 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "bsp.hpp"
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Malha indexada compacta: vértices repetidos da entrada viram um só, os índices são 0-based e ocupam 16 bits
+ * quando há até 65536 vértices (32 bits caso contrário). Os triângulos podem vir reordenados pela curva de Morton
+ * dos centroides, e os vértices ficam na ordem em que os triângulos os usam pela primeira vez, então triângulos
+ * vizinhos no espaço ficam próximos na memória.
+ */
+struct CompactMesh {
+  vector<Point3D> points;           // Vértices distintos, na ordem do primeiro uso
+  vector<uint16_t> indices16;       // Três índices por triângulo, com até 65536 vértices
+  vector<uint32_t> indices32;       // Três índices por triângulo, com mais vértices
+  vector<int> original;             // Triângulo da entrada (0-based) de cada triângulo da malha
+  size_t input_points = 0;          // Vértices da entrada, antes da soldagem
+
+  size_t size() const { return original.size(); }
+
+  /**
+   * Índice do vértice k (0, 1 ou 2) do triângulo tri.
+   */
+  uint32_t index(size_t tri, int k) const { return indices32.empty() ? indices16[3 * tri + k] : indices32[3 * tri + k]; }
+
+  Point3D vertex(size_t tri, int k) const { return points[index(tri, k)]; }
+
+  /**
+   * @return Bytes de vértices, índices e mapa para a entrada
+   */
+  size_t bytes() const;
+};
+
+/**
+ * Solda os vértices iguais, descarta os que nenhum triângulo usa e converte os índices para 0-based.
+ * @param triangles Triângulos da entrada (índices 1-based)
+ * @param points Vértices da entrada
+ * @param reorder Ordena os triângulos pelo código de Morton do centroide; sem isso mantém a ordem da entrada
+ * @return Malha compacta com os mesmos triângulos
+ */
+CompactMesh compactMesh(Span<Triangle> triangles, Span<Point3D> points, bool reorder = true);
+
+/**
+ * Monta o cache na ordem dos triângulos da malha. Se a malha foi reordenada, cache.original leva de volta aos
+ * índices da entrada, e QuerySession devolve os resultados já nesses índices.
+ * @param mesh Malha compacta
+ * @return Cache com uma entrada por triângulo da malha
+ */
+TriangleCache buildTriangleCache(const CompactMesh& mesh);
+
+#endif // MESH_HPP
@@ -0,0 +1,233 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#include "packet.hpp"
+#include <immintrin.h>
+
+using namespace std;
+
+// Linhas de folga no fim dos arrays: um pacote AVX2 inteiro
+const size_t PACKET_PADDING = 4;
+
+// ======================================================================================================================= //
+
+SimdLevel detectSimdLevel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+  if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE4;
+  return SimdLevel::SCALAR;
+}
+
+SimdLevel resolveSimdLevel(SimdLevel requested) {
+  SimdLevel detected = detectSimdLevel();
+  if (requested == SimdLevel::AUTO) return detected;
+  return (int)requested > (int)detected ? detected : requested;
+}
+
+const char* simdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::AUTO: return "auto";
+    case SimdLevel::SCALAR: return "scalar";
+    case SimdLevel::SSE4: return "sse4";
+    case SimdLevel::AVX2: return "avx2";
+  }
+  return "?";
+}
+
+bool parseSimdLevel(const string& name, SimdLevel& level) {
+  if (name == "auto") level = SimdLevel::AUTO;
+  else if (name == "scalar") level = SimdLevel::SCALAR;
+  else if (name == "sse4") level = SimdLevel::SSE4;
+  else if (name == "avx2") level = SimdLevel::AVX2;
+  else return false;
+  return true;
+}
+
+// ======================================================================================================================= //
+
+TrianglePackets buildTrianglePackets(const TriangleCache& cache, Span<int> triangle_ids, SimdLevel level) {
+  TrianglePackets packets;
+  packets.level = resolveSimdLevel(level);
+  packets.exact = cache.max_coord < PACKET_COORD_LIMIT;
+  packets.ids.assign(triangle_ids.begin(), triangle_ids.end());
+
+  // Sem pacotes exatos só o teste escalar é usado e os arrays em double não são necessários
+  if (packets.level == SimdLevel::SCALAR || !packets.exact) {
+    packets.level = SimdLevel::SCALAR;
+    return packets;
+  }
+
+  size_t n = triangle_ids.size();
+  for (vector<double>* v : {&packets.x0, &packets.y0, &packets.z0, &packets.e1x, &packets.e1y, &packets.e1z,
+                            &packets.e2x, &packets.e2y, &packets.e2z, &packets.nx, &packets.ny, &packets.nz, &packets.d})
+    v->assign(n + PACKET_PADDING, 0.0);
+
+  for (size_t row = 0; row < n; ++row) {
+    int i = triangle_ids[row];
+    packets.x0[row] = cache.x0[i];   packets.y0[row] = cache.y0[i];   packets.z0[row] = cache.z0[i];
+    packets.e1x[row] = cache.e1x[i]; packets.e1y[row] = cache.e1y[i]; packets.e1z[row] = cache.e1z[i];
+    packets.e2x[row] = cache.e2x[i]; packets.e2y[row] = cache.e2y[i]; packets.e2z[row] = cache.e2z[i];
+    packets.nx[row] = (double)cache.nx[i];
+    packets.ny[row] = (double)cache.ny[i];
+    packets.nz[row] = (double)cache.nz[i];
+
+    // Com |n| < 2^33 o cache pode não ter d; aqui cada produto fica abaixo de 2^48 e a soma é exata
+    packets.d[row] = packets.nx[row] * cache.x0[i] + packets.ny[row] * cache.y0[i] + packets.nz[row] * cache.z0[i];
+  }
+  return packets;
+}
+
+// ======================================================================================================================= //
+
+// Os kernels seguem segmentIntersectsTriangle passo a passo: lados dos extremos (n · q - d) e volumes
+// orientados (ui x uj) · ab, com ui = pi - a. Todos os valores são inteiros abaixo de 2^53, então as contas
+// em double são exatas e só os sinais são usados. Cada kernel devolve, por linha, um bit de acerto e um bit
+// de "decidir no escalar" (n · ab = 0: segmento paralelo, coplanar ou triângulo degenerado).
+
+// (x1, y1, z1) · (x2, y2, z2)
+__attribute__((target("avx2")))
+static inline __m256d dotAVX2(__m256d x1, __m256d y1, __m256d z1, __m256d x2, __m256d y2, __m256d z2) {
+  return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x1, x2), _mm256_mul_pd(y1, y2)), _mm256_mul_pd(z1, z2));
+}
+
+// (u x v) · ab
+__attribute__((target("avx2")))
+static inline __m256d volumeAVX2(__m256d ux, __m256d uy, __m256d uz, __m256d vx, __m256d vy, __m256d vz, __m256d abx, __m256d aby, __m256d abz) {
+  __m256d cx = _mm256_sub_pd(_mm256_mul_pd(uy, vz), _mm256_mul_pd(uz, vy));
+  __m256d cy = _mm256_sub_pd(_mm256_mul_pd(uz, vx), _mm256_mul_pd(ux, vz));
+  __m256d cz = _mm256_sub_pd(_mm256_mul_pd(ux, vy), _mm256_mul_pd(uy, vx));
+  return dotAVX2(cx, cy, cz, abx, aby, abz);
+}
+
+__attribute__((target("avx2")))
+static void kernelAVX2(const Point3D& a, const Point3D& b, const TrianglePackets& p, size_t row, unsigned& hit, unsigned& fallback) {
+  const __m256d zero = _mm256_setzero_pd();
+  __m256d ax = _mm256_set1_pd(a.x), ay = _mm256_set1_pd(a.y), az = _mm256_set1_pd(a.z);
+  __m256d bx = _mm256_set1_pd(b.x), by = _mm256_set1_pd(b.y), bz = _mm256_set1_pd(b.z);
+  __m256d abx = _mm256_sub_pd(bx, ax), aby = _mm256_sub_pd(by, ay), abz = _mm256_sub_pd(bz, az);
+
+  __m256d nx = _mm256_loadu_pd(&p.nx[row]), ny = _mm256_loadu_pd(&p.ny[row]), nz = _mm256_loadu_pd(&p.nz[row]);
+  __m256d d = _mm256_loadu_pd(&p.d[row]);
+
+  __m256d parallel = _mm256_cmp_pd(dotAVX2(nx, ny, nz, abx, aby, abz), zero, _CMP_EQ_OQ);
+  __m256d sa = _mm256_sub_pd(dotAVX2(nx, ny, nz, ax, ay, az), d);
+  __m256d sb = _mm256_sub_pd(dotAVX2(nx, ny, nz, bx, by, bz), d);
+  __m256d same_side = _mm256_or_pd(
+    _mm256_and_pd(_mm256_cmp_pd(sa, zero, _CMP_GT_OQ), _mm256_cmp_pd(sb, zero, _CMP_GT_OQ)),
+    _mm256_and_pd(_mm256_cmp_pd(sa, zero, _CMP_LT_OQ), _mm256_cmp_pd(sb, zero, _CMP_LT_OQ)));
+
+  __m256d u0x = _mm256_sub_pd(_mm256_loadu_pd(&p.x0[row]), ax);
+  __m256d u0y = _mm256_sub_pd(_mm256_loadu_pd(&p.y0[row]), ay);
+  __m256d u0z = _mm256_sub_pd(_mm256_loadu_pd(&p.z0[row]), az);
+  __m256d u1x = _mm256_add_pd(u0x, _mm256_loadu_pd(&p.e1x[row]));
+  __m256d u1y = _mm256_add_pd(u0y, _mm256_loadu_pd(&p.e1y[row]));
+  __m256d u1z = _mm256_add_pd(u0z, _mm256_loadu_pd(&p.e1z[row]));
+  __m256d u2x = _mm256_add_pd(u0x, _mm256_loadu_pd(&p.e2x[row]));
+  __m256d u2y = _mm256_add_pd(u0y, _mm256_loadu_pd(&p.e2y[row]));
+  __m256d u2z = _mm256_add_pd(u0z, _mm256_loadu_pd(&p.e2z[row]));
+
+  __m256d v01 = volumeAVX2(u0x, u0y, u0z, u1x, u1y, u1z, abx, aby, abz);
+  __m256d v12 = volumeAVX2(u1x, u1y, u1z, u2x, u2y, u2z, abx, aby, abz);
+  __m256d v20 = volumeAVX2(u2x, u2y, u2z, u0x, u0y, u0z, abx, aby, abz);
+
+  __m256d positive = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(v01, zero, _CMP_GT_OQ), _mm256_cmp_pd(v12, zero, _CMP_GT_OQ)),
+                                  _mm256_cmp_pd(v20, zero, _CMP_GT_OQ));
+  __m256d negative = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(v01, zero, _CMP_LT_OQ), _mm256_cmp_pd(v12, zero, _CMP_LT_OQ)),
+                                  _mm256_cmp_pd(v20, zero, _CMP_LT_OQ));
+  __m256d miss = _mm256_or_pd(same_side, _mm256_and_pd(positive, negative));
+
+  fallback = (unsigned)_mm256_movemask_pd(parallel);
+  hit = ~(unsigned)_mm256_movemask_pd(_mm256_or_pd(miss, parallel)) & 0xF;
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128d dotSSE4(__m128d x1, __m128d y1, __m128d z1, __m128d x2, __m128d y2, __m128d z2) {
+  return _mm_add_pd(_mm_add_pd(_mm_mul_pd(x1, x2), _mm_mul_pd(y1, y2)), _mm_mul_pd(z1, z2));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128d volumeSSE4(__m128d ux, __m128d uy, __m128d uz, __m128d vx, __m128d vy, __m128d vz, __m128d abx, __m128d aby, __m128d abz) {
+  __m128d cx = _mm_sub_pd(_mm_mul_pd(uy, vz), _mm_mul_pd(uz, vy));
+  __m128d cy = _mm_sub_pd(_mm_mul_pd(uz, vx), _mm_mul_pd(ux, vz));
+  __m128d cz = _mm_sub_pd(_mm_mul_pd(ux, vy), _mm_mul_pd(uy, vx));
+  return dotSSE4(cx, cy, cz, abx, aby, abz);
+}
+
+__attribute__((target("sse4.1")))
+static void kernelSSE4(const Point3D& a, const Point3D& b, const TrianglePackets& p, size_t row, unsigned& hit, unsigned& fallback) {
+  const __m128d zero = _mm_setzero_pd();
+  __m128d ax = _mm_set1_pd(a.x), ay = _mm_set1_pd(a.y), az = _mm_set1_pd(a.z);
+  __m128d bx = _mm_set1_pd(b.x), by = _mm_set1_pd(b.y), bz = _mm_set1_pd(b.z);
+  __m128d abx = _mm_sub_pd(bx, ax), aby = _mm_sub_pd(by, ay), abz = _mm_sub_pd(bz, az);
+
+  __m128d nx = _mm_loadu_pd(&p.nx[row]), ny = _mm_loadu_pd(&p.ny[row]), nz = _mm_loadu_pd(&p.nz[row]);
+  __m128d d = _mm_loadu_pd(&p.d[row]);
+
+  __m128d parallel = _mm_cmpeq_pd(dotSSE4(nx, ny, nz, abx, aby, abz), zero);
+  __m128d sa = _mm_sub_pd(dotSSE4(nx, ny, nz, ax, ay, az), d);
+  __m128d sb = _mm_sub_pd(dotSSE4(nx, ny, nz, bx, by, bz), d);
+  __m128d same_side = _mm_or_pd(_mm_and_pd(_mm_cmpgt_pd(sa, zero), _mm_cmpgt_pd(sb, zero)),
+                                _mm_and_pd(_mm_cmplt_pd(sa, zero), _mm_cmplt_pd(sb, zero)));
+
+  __m128d u0x = _mm_sub_pd(_mm_loadu_pd(&p.x0[row]), ax);
+  __m128d u0y = _mm_sub_pd(_mm_loadu_pd(&p.y0[row]), ay);
+  __m128d u0z = _mm_sub_pd(_mm_loadu_pd(&p.z0[row]), az);
+  __m128d u1x = _mm_add_pd(u0x, _mm_loadu_pd(&p.e1x[row]));
+  __m128d u1y = _mm_add_pd(u0y, _mm_loadu_pd(&p.e1y[row]));
+  __m128d u1z = _mm_add_pd(u0z, _mm_loadu_pd(&p.e1z[row]));
+  __m128d u2x = _mm_add_pd(u0x, _mm_loadu_pd(&p.e2x[row]));
+  __m128d u2y = _mm_add_pd(u0y, _mm_loadu_pd(&p.e2y[row]));
+  __m128d u2z = _mm_add_pd(u0z, _mm_loadu_pd(&p.e2z[row]));
+
+  __m128d v01 = volumeSSE4(u0x, u0y, u0z, u1x, u1y, u1z, abx, aby, abz);
+  __m128d v12 = volumeSSE4(u1x, u1y, u1z, u2x, u2y, u2z, abx, aby, abz);
+  __m128d v20 = volumeSSE4(u2x, u2y, u2z, u0x, u0y, u0z, abx, aby, abz);
+
+  __m128d positive = _mm_or_pd(_mm_or_pd(_mm_cmpgt_pd(v01, zero), _mm_cmpgt_pd(v12, zero)), _mm_cmpgt_pd(v20, zero));
+  __m128d negative = _mm_or_pd(_mm_or_pd(_mm_cmplt_pd(v01, zero), _mm_cmplt_pd(v12, zero)), _mm_cmplt_pd(v20, zero));
+  __m128d miss = _mm_or_pd(same_side, _mm_and_pd(positive, negative));
+
+  fallback = (unsigned)_mm_movemask_pd(parallel);
+  hit = ~(unsigned)_mm_movemask_pd(_mm_or_pd(miss, parallel)) & 0x3;
+}
+
+// ======================================================================================================================= //
+
+size_t intersectPacket(const Point3D& a, const Point3D& b, const TrianglePackets& packets, const TriangleCache& cache, size_t begin, size_t count, int* hits) {
+  size_t found = 0;
+
+  auto inRange = [](const Point3D& p) {
+    return abs(p.x) < PACKET_COORD_LIMIT && abs(p.y) < PACKET_COORD_LIMIT && abs(p.z) < PACKET_COORD_LIMIT;
+  };
+  if (packets.level == SimdLevel::SCALAR || !inRange(a) || !inRange(b)) {
+    for (size_t row = begin; row < begin + count; ++row) {
+      int tri = packets.ids[row];
+      if (segmentIntersectsTriangle(a, b, cache, tri)) hits[found++] = tri;
+    }
+    return found;
+  }
+
+  size_t width = packets.level == SimdLevel::AVX2 ? 4 : 2;
+  for (size_t row = begin; row < begin + count; row += width) {
+    unsigned hit, fallback;
+    if (packets.level == SimdLevel::AVX2) kernelAVX2(a, b, packets, row, hit, fallback);
+    else kernelSSE4(a, b, packets, row, hit, fallback);
+
+    // Linhas além do balde são descartadas pela máscara
+    size_t lanes = min(width, begin + count - row);
+    for (size_t k = 0; k < lanes; ++k) {
+      int tri = packets.ids[row + k];
+      bool intersects = (fallback >> k) & 1 ? segmentIntersectsTriangle(a, b, cache, tri) : (hit >> k) & 1;
+      if (intersects) hits[found++] = tri;
+    }
+  }
+  return found;
+}
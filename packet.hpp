@@ -0,0 +1,97 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include "bsp.hpp"
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Limite (exclusivo) do módulo das coordenadas para o teste em pacote. Abaixo dele as diferenças ficam
+ * abaixo de 2^16, os volumes orientados abaixo de 2^52 e todas as contas são feitas com inteiros exatos
+ * em double, dando o mesmo resultado de segmentIntersectsTriangle. Acima dele o pacote usa o teste escalar.
+ */
+const int PACKET_COORD_LIMIT = 1 << 15;
+
+/**
+ * Dados dos triângulos dos baldes da BSP, na ordem de FlatBSP::leaf_triangles e convertidos para double,
+ * para que cada balde seja um trecho contíguo de cada array. Os arrays têm linhas extras zeradas no fim,
+ * então um pacote pode ser lido inteiro mesmo no último balde.
+ */
+struct TrianglePackets {
+  vector<double> x0, y0, z0;        // Primeiro vértice
+  vector<double> e1x, e1y, e1z;     // Aresta p1 - p0
+  vector<double> e2x, e2y, e2z;     // Aresta p2 - p0
+  vector<double> nx, ny, nz;        // Normal do plano
+  vector<double> d;                 // Deslocamento do plano (n · p0)
+  vector<int> ids;                  // Triângulo de cada linha
+  bool exact = false;               // Todas as coordenadas abaixo de PACKET_COORD_LIMIT
+  SimdLevel level = SimdLevel::SCALAR;
+};
+
+// ======================================================================================================================= //
+
+/**
+ * Detecta o melhor conjunto de instruções suportado pela CPU.
+ * @return AVX2, SSE4 ou SCALAR
+ */
+SimdLevel detectSimdLevel();
+
+/**
+ * Resolve o nível pedido contra a CPU: AUTO vira o detectado e níveis não suportados são rebaixados.
+ * @param requested Nível pedido
+ * @return Nível efetivamente usado
+ */
+SimdLevel resolveSimdLevel(SimdLevel requested);
+
+/**
+ * @param level Nível de instruções
+ * @return Nome do nível ("auto", "scalar", "sse4" ou "avx2")
+ */
+const char* simdLevelName(SimdLevel level);
+
+/**
+ * Converte o nome de um nível ("auto", "scalar", "sse4" ou "avx2") para o enum.
+ * @param name Nome do nível
+ * @param level Recebe o nível, se o nome for válido
+ * @return false se o nome não corresponde a nenhum nível
+ */
+bool parseSimdLevel(const string& name, SimdLevel& level);
+
+/**
+ * Monta os pacotes dos baldes de uma BSP.
+ * @param cache Cache dos triângulos
+ * @param triangle_ids Triângulos de cada linha (FlatBSP::leaf_triangles)
+ * @param level Nível de instruções pedido (resolvido com resolveSimdLevel)
+ * @return Pacotes prontos para intersectPacket
+ */
+TrianglePackets buildTrianglePackets(const TriangleCache& cache, Span<int> triangle_ids, SimdLevel level);
+
+/**
+ * Testa um segmento contra as linhas [begin, begin + count) dos pacotes, vários triângulos por instrução.
+ * O resultado é sempre idêntico ao de segmentIntersectsTriangle: fora do intervalo exato, e nos triângulos
+ * paralelos ao segmento, o teste escalar é usado.
+ * @param a Ponto inicial do segmento
+ * @param b Ponto final do segmento
+ * @param packets Pacotes dos baldes
+ * @param cache Cache dos triângulos, usado pelo teste escalar
+ * @param begin Primeira linha
+ * @param count Número de linhas
+ * @param hits Recebe os índices (0-based) dos triângulos intersectados, em ordem de linha; precisa de count posições
+ * @return Número de triângulos intersectados
+ */
+size_t intersectPacket(const Point3D& a, const Point3D& b, const TrianglePackets& packets, const TriangleCache& cache, size_t begin, size_t count, int* hits);
+
+#endif // PACKET_HPP
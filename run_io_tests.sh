@@ -0,0 +1,148 @@
+#!/bin/bash
+
+# Testes dos arquivos em disco (malha binária e árvore), do modo de fluxo e das entradas inválidas: cada ida e
+# volta precisa reproduzir o gabarito de tests/answers, e cada arquivo corrompido ou trocado, cabeçalho ou flag
+# inválida precisa ser rejeitado com código 1 e a mensagem esperada na saída de erro.
+
+TEST_DIR="tests/inputs"
+ANSWER_DIR="tests/answers"
+ARGS="--leaf-size=8"
+
+if [[ ! -x ./bsp ]]; then
+  echo "Erro: o executável ./bsp não foi encontrado ou não tem permissão de execução."
+  exit 1
+fi
+
+# Arquivos gerados pelos testes, apagados na saída
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "$TMP_DIR"' EXIT
+
+FAILURES=0
+
+# expectOutput <nome> <gabarito> <comando>: o comando precisa terminar com sucesso e imprimir o gabarito
+expectOutput() {
+  local name="$1" answer="$2" command="$3"
+  eval "timeout 60 $command" > "$TMP_DIR/output" 2> /dev/null
+  local status=$?
+  if [[ $status -eq 0 ]] && diff -q "$answer" "$TMP_DIR/output" > /dev/null; then
+    echo "✔ $name"
+  else
+    echo "✘ $name (código $status)"
+    FAILURES=$((FAILURES + 1))
+  fi
+}
+
+# expectError <nome> <mensagem> <comando>: o comando precisa falhar com código 1 e a mensagem na saída de erro
+expectError() {
+  local name="$1" message="$2" command="$3"
+  local output
+  output=$(eval "timeout 60 $command" 2>&1 > /dev/null)
+  local status=$?
+  if [[ $status -eq 1 && "$output" == *"$message"* ]]; then
+    echo "✔ $name"
+  else
+    echo "✘ $name (código $status: $output)"
+    FAILURES=$((FAILURES + 1))
+  fi
+}
+
+# Malha convertida com o subcomando convert e carregada de volta com --binary (os segmentos vêm do arquivo)
+for test_file in "$TEST_DIR"/*.in; do
+  test_name=$(basename "$test_file" .in)
+  ./bsp convert "$TMP_DIR/$test_name.bin" < "$test_file"
+  expectOutput "binário $test_name" "$ANSWER_DIR/$test_name.out" "./bsp $ARGS --binary='$TMP_DIR/$test_name.bin' < /dev/null"
+done
+
+# Binário com assinatura trocada
+cp "$TMP_DIR/8.bin" "$TMP_DIR/magic.bin"
+printf 'X' | dd of="$TMP_DIR/magic.bin" bs=1 conv=notrunc status=none
+expectError "binário com assinatura inválida" "assinatura inválida" "./bsp --binary='$TMP_DIR/magic.bin' < /dev/null"
+
+# Binário truncado no meio do cabeçalho e com os arrays cortados
+head -c 40 "$TMP_DIR/8.bin" > "$TMP_DIR/short.bin"
+expectError "binário truncado" "arquivo binário truncado" "./bsp --binary='$TMP_DIR/short.bin' < /dev/null"
+head -c 200 "$TMP_DIR/8.bin" > "$TMP_DIR/cut.bin"
+expectError "binário com arrays cortados" "fora do arquivo" "./bsp --binary='$TMP_DIR/cut.bin' < /dev/null"
+
+# Binário cujo primeiro triângulo usa o vértice 0 (os índices são 1-based; triangles_offset fica no byte 48)
+cp "$TMP_DIR/8.bin" "$TMP_DIR/index.bin"
+triangles_offset=$(od -An -t u8 -j 48 -N 8 "$TMP_DIR/index.bin" | tr -d ' ')
+printf '\x00\x00\x00\x00' | dd of="$TMP_DIR/index.bin" bs=1 seek="$triangles_offset" conv=notrunc status=none
+expectError "binário com índice inválido" "triângulo com índice de vértice inválido" "./bsp --binary='$TMP_DIR/index.bin' < /dev/null"
+
+# Árvore gravada com --save-tree e usada de volta com --load-tree, sem reconstruir
+for test_file in "$TEST_DIR"/*.in; do
+  test_name=$(basename "$test_file" .in)
+  tree="$TMP_DIR/$test_name.tree"
+  ./bsp $ARGS --save-tree="$tree" < "$test_file" > /dev/null
+  expectOutput "árvore $test_name" "$ANSWER_DIR/$test_name.out" "./bsp $ARGS --load-tree='$tree' < '$test_file'"
+done
+
+# Árvore de uma malha carregada com outra
+expectError "árvore de outra malha" "árvore construída para outra malha" \
+  "./bsp --load-tree='$TMP_DIR/8.tree' < '$TEST_DIR/7.in'"
+
+# Árvore com ciclo: o filho da frente da raiz aponta para a própria raiz (os filhos ficam em nodes_offset + 24)
+cp "$TMP_DIR/8.tree" "$TMP_DIR/cycle.tree"
+nodes_offset=$(od -An -t u8 -j 48 -N 8 "$TMP_DIR/cycle.tree" | tr -d ' ')
+printf '\x00\x00\x00\x00' | dd of="$TMP_DIR/cycle.tree" bs=1 seek=$((nodes_offset + 24)) conv=notrunc status=none
+expectError "árvore com ciclo" "nó com referência inválida" \
+  "./bsp --load-tree='$TMP_DIR/cycle.tree' < '$TEST_DIR/8.in'"
+
+# Árvore truncada no meio do cabeçalho
+head -c 50 "$TMP_DIR/8.tree" > "$TMP_DIR/short.tree"
+expectError "árvore truncada" "arquivo de árvore truncado" \
+  "./bsp --load-tree='$TMP_DIR/short.tree' < '$TEST_DIR/8.in'"
+
+# Cabeçalho texto que promete mais registros do que a entrada traz: erro de leitura, sem alocar pelo cabeçalho
+printf '900000000 1 1\n0 0 0' > "$TMP_DIR/header.in"
+expectError "cabeçalho maior que o arquivo" "Entrada inválida" "./bsp < '$TMP_DIR/header.in'"
+expectError "cabeçalho maior que o pipe" "Entrada inválida" "cat '$TMP_DIR/header.in' | ./bsp"
+
+# Flags numéricas com valor que não é número ou é negativo onde não faz sentido
+for flag in --leaf-size=abc --candidates=-1 --threads=-2 --batch=-1 --seed=x --max-depth=3x; do
+  expectError "flag $flag" "valor inválido para ${flag%%=*}" "./bsp $flag < '$TEST_DIR/1.in'"
+done
+
+# uint32 little-endian na saída padrão (quantidade de segmentos de um lote binário)
+writeCount() {
+  local n=$1
+  printf "$(printf '\\x%02x\\x%02x\\x%02x\\x%02x' $((n & 255)) $((n >> 8 & 255)) $((n >> 16 & 255)) $((n >> 24 & 255)))"
+}
+
+# Modo de fluxo: metade dos segmentos fica no cabeçalho e o resto chega depois, em lotes pequenos. No modo
+# binário a malha vai sem segmentos e eles chegam em dois lotes, copiados do array de segmentos do .bin.
+for test_file in "$TEST_DIR"/*.in; do
+  test_name=$(basename "$test_file" .in)
+  answer="$ANSWER_DIR/$test_name.out"
+  awk 'NR == 1 { print $1, $2, int($3 / 2); next } { print }' "$test_file" > "$TMP_DIR/half.in"
+  expectOutput "fluxo texto $test_name" "$answer" "./bsp $ARGS --stream --batch=3 < '$TMP_DIR/half.in'"
+
+  awk 'NR == 1 { print $1, $2, 0; next } { print }' "$test_file" > "$TMP_DIR/mesh.in"
+  ./bsp convert "$TMP_DIR/mesh.bin" < "$TMP_DIR/mesh.in"
+  segments=$(od -An -t u8 -j 32 -N 8 "$TMP_DIR/$test_name.bin" | tr -d ' ')
+  segments_offset=$(od -An -t u8 -j 56 -N 8 "$TMP_DIR/$test_name.bin" | tr -d ' ')
+  first=$((segments / 2))
+  {
+    writeCount $first
+    tail -c +$((segments_offset + 1)) "$TMP_DIR/$test_name.bin" | head -c $((24 * first))
+    writeCount $((segments - first))
+    tail -c +$((segments_offset + 24 * first + 1)) "$TMP_DIR/$test_name.bin" | head -c $((24 * (segments - first)))
+  } > "$TMP_DIR/batches.bin"
+  expectOutput "fluxo binário $test_name" "$answer" \
+    "./bsp $ARGS --binary='$TMP_DIR/mesh.bin' --stream=binary --batch=5 < '$TMP_DIR/batches.bin'"
+done
+
+# Lote binário que anuncia mais segmentos do que traz
+{ writeCount 2; head -c 30 /dev/zero; } > "$TMP_DIR/truncated.bin"
+expectError "lote binário truncado" "lote de segmentos truncado" \
+  "./bsp --binary='$TMP_DIR/8.bin' --stream=binary < '$TMP_DIR/truncated.bin'"
+
+# Segmento de texto incompleto no fluxo
+{ cat "$TEST_DIR/8.in"; echo "1 2 3"; } > "$TMP_DIR/partial.in"
+expectError "fluxo texto incompleto" "Entrada inválida" "./bsp --stream < '$TMP_DIR/partial.in'"
+
+if [[ $FAILURES -gt 0 ]]; then
+  echo "$FAILURES teste(s) de arquivo falharam."
+  exit 1
+fi
@@ -6,6 +6,7 @@ OUTPUT_DIR="tests/outputs"
 ANSWER_DIR="tests/answers"
 VERBOSE=""
 PRINT_STDOUT=false
+EXTRA_ARGS=""
 
 # Verifica as flags passadas
 while [[ $# -gt 0 ]]; do
@@ -18,8 +19,13 @@ while [[ $# -gt 0 ]]; do
       PRINT_STDOUT=true
       shift
       ;;
+    -a)
+      # Argumentos extras repassados ao ./bsp (ex.: -a "--split=sah")
+      EXTRA_ARGS="$2"
+      shift 2
+      ;;
     *)
-      echo "Uso: $0 [-v] [-o]"
+      echo "Uso: $0 [-v] [-o] [-a \"<args do bsp>\"]"
       exit 1
       ;;
   esac
@@ -34,6 +40,9 @@ fi
 # Cria a pasta de saída se necessário
 mkdir -p "$OUTPUT_DIR"
 
+# Número de testes com saída diferente do gabarito (vira o código de saída do script)
+FAILURES=0
+
 # Loop por todos os arquivos .in na pasta de testes
 for test_file in "$TEST_DIR"/*.in; do
   test_name=$(basename "$test_file" .in)
@@ -43,9 +52,9 @@ for test_file in "$TEST_DIR"/*.in; do
   echo "Executando teste: $test_file"
 
   if $PRINT_STDOUT; then
-    ./bsp $VERBOSE < "$test_file"
+    ./bsp $VERBOSE $EXTRA_ARGS < "$test_file"
   else
-    ./bsp $VERBOSE < "$test_file" > "$output_file"
+    ./bsp $VERBOSE $EXTRA_ARGS < "$test_file" > "$output_file"
     echo "Saída escrita em: $output_file"
   fi
 
@@ -57,6 +66,7 @@ for test_file in "$TEST_DIR"/*.in; do
     else
       echo "✘ Teste $test_name: saída diferente da esperada:"
       echo "$diff_output"
+      FAILURES=$((FAILURES + 1))
     fi
   else
     echo "⚠ Arquivo de resposta $answer_file não encontrado. Pulei a comparação."
@@ -64,3 +74,8 @@ for test_file in "$TEST_DIR"/*.in; do
 
   echo "-----------------------------"
 done
+
+if [[ $FAILURES -gt 0 ]]; then
+  echo "$FAILURES teste(s) com saída diferente da esperada."
+  exit 1
+fi
@@ -0,0 +1,134 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+// Teste de regressão da DynamicBSP: intercala inserções, remoções e consultas e compara cada consulta com
+// segmentIntersectsTriangle sobre todos os triângulos vivos. Também limita as reconstruções a uma por
+// atualização, o que falha se uma atualização SPANNING reconstruir cada subárvore do seu caminho.
+
+#include "bsp.hpp"
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+/**
+ * Um cenário: malha inicial e triângulos inseridos com vértices a até size do centro, sorteados no cubo
+ * [-EXTENT, EXTENT], e os parâmetros de construção. Triângulos grandes cruzam muitos planos e exercitam os
+ * SPANNING; com eles min_triangles começa em 2, como no benchmark, para a construção inicial não explodir.
+ */
+struct Scenario {
+  const char* name;
+  int triangles;
+  int size;
+  int leaf_size;
+  int min_triangles;
+};
+
+const int EXTENT = 4000;
+const int UPDATES = 400;
+const int QUERY_EVERY = 25;
+const int SEGMENTS = 40;
+
+static Point3D randomPoint(mt19937_64& rng, int extent) {
+  uniform_int_distribution<int> coord(-extent, extent);
+  return Point3D(coord(rng), coord(rng), coord(rng));
+}
+
+// Triângulo com os três vértices a até size de um centro sorteado
+static void randomTriangle(mt19937_64& rng, int size, vector<Point3D>& points) {
+  Point3D center = randomPoint(rng, EXTENT - size);
+  uniform_int_distribution<int> offset(-size, size);
+  for (int k = 0; k < 3; ++k) points.emplace_back(center.x + offset(rng), center.y + offset(rng), center.z + offset(rng));
+}
+
+// Confere as consultas da árvore contra o teste direto em todos os triângulos vivos
+static bool checkQueries(mt19937_64& rng, const DynamicBSP& tree, const vector<Point3D>& points, const vector<Triangle>& triangles) {
+  vector<Segment> segments;
+  for (int i = 0; i < SEGMENTS; ++i) {
+    Point3D a = randomPoint(rng, EXTENT), b = randomPoint(rng, EXTENT);
+    segments.emplace_back(a.x, a.y, a.z, b.x, b.y, b.z);
+  }
+
+  QueryResults results = tree.query(segments);
+  for (size_t s = 0; s < segments.size(); ++s) {
+    vector<int> expected;
+    for (size_t t = 0; t < triangles.size(); ++t) {
+      if (tree.contains((int)t + 1) && segmentIntersectsTriangle(segments[s].p1, segments[s].p2, triangles[t], points))
+        expected.push_back((int)t + 1);
+    }
+    Span<int> got = results[s];
+    if (!equal(got.begin(), got.end(), expected.begin(), expected.end())) return false;
+  }
+  return true;
+}
+
+static bool runScenario(const Scenario& scenario, unsigned long long seed) {
+  auto start = chrono::steady_clock::now();
+  mt19937_64 rng(seed);
+  vector<Point3D> points;
+  vector<Triangle> triangles;
+  for (int i = 0; i < scenario.triangles; ++i) {
+    randomTriangle(rng, scenario.size, points);
+    triangles.emplace_back(3 * i + 1, 3 * i + 2, 3 * i + 3);
+  }
+
+  BuildOptions options;
+  options.leaf_size = scenario.leaf_size;
+  options.min_triangles = scenario.min_triangles;
+  DynamicBSP tree(triangles, points, options);
+
+  bool ok = checkQueries(rng, tree, points, triangles);
+  for (int update = 1; update <= UPDATES && ok; ++update) {
+    // Seis de cada dez atualizações inserem; as demais removem um triângulo sorteado (que pode já estar removido)
+    if (rng() % 10 < 6) {
+      randomTriangle(rng, scenario.size, points);
+      int n = (int)points.size();
+      triangles.emplace_back(n - 2, n - 1, n);
+      int index = tree.insert(points[n - 3], points[n - 2], points[n - 1]);
+      ok = index == (int)triangles.size();
+    } else {
+      int index = (int)(rng() % triangles.size()) + 1;
+      bool alive = tree.contains(index);
+      ok = tree.remove(index) == alive && !tree.contains(index);
+    }
+    if (ok && update % QUERY_EVERY == 0) ok = checkQueries(rng, tree, points, triangles);
+  }
+
+  UpdateStats stats = tree.stats();
+  bool bounded = stats.rebuilds <= (size_t)UPDATES;
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  if (ok && bounded) {
+    printf("✔ %s: %zu reconstruções, %zu triângulos reconstruídos, %.0f ms\n", scenario.name, stats.rebuilds, stats.rebuilt_triangles, ms);
+  } else if (!ok) {
+    printf("✘ %s: consulta ou atualização diferente da esperada\n", scenario.name);
+  } else {
+    printf("✘ %s: %zu reconstruções em %d atualizações\n", scenario.name, stats.rebuilds, UPDATES);
+  }
+  fflush(stdout);
+  return ok && bounded;
+}
+
+int main() {
+  const Scenario scenarios[] = {
+    {"triângulos pequenos", 300, 60, 0, 1},
+    {"triângulos pequenos com baldes", 300, 60, 8, 1},
+    {"triângulos grandes", 300, 2500, 0, 2},
+    {"triângulos grandes com baldes", 300, 2500, 8, 2},
+  };
+
+  int failures = 0;
+  for (const Scenario& scenario : scenarios) {
+    for (unsigned long long seed = 1; seed <= 3; ++seed) failures += !runScenario(scenario, seed);
+  }
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+/***********************************************************************
+ *
+ * Autor: Richard Fernando Heise Ferreira
+ * Matrícula: 201900121214
+ * Data: 06/2025
+ * Instituição: Universidade Federal do Paraná
+ * Curso: Mestrado em Segurança da Computação - PPG-Inf
+ * Motivo: Trabalho 3 da disciplina de Geometria Computacional
+ *
+ ************************************************************************/
+
+// Teste da biblioteca (libbsp): monta um BSPMesh a partir dos spans de uma entrada, consulta o mesmo objeto de
+// várias threads ao mesmo tempo, por query e por sessões próprias, e compara cada resultado com o gabarito
+// da mesma entrada em tests/answers. Ligado tanto a libbsp.a quanto a libbsp.so.
+
+#include "libbsp.hpp"
+#include "input.hpp"
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// ======================================================================================================================= //
+
+const int THREADS = 4;
+const int ROUNDS = 5;
+
+// Gabarito no formato da saída do bsp: por linha, a quantidade de triângulos seguida dos índices
+static vector<vector<int>> readAnswer(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) throw runtime_error(string("não foi possível abrir ") + path);
+  InputReader in(fd);
+  vector<vector<int>> answer;
+  while (!in.atEnd()) {
+    vector<int>& ids = answer.emplace_back(in.readInt("a quantidade de triângulos"));
+    for (int& id : ids) id = in.readInt("índice de triângulo");
+  }
+  close(fd);
+  return answer;
+}
+
+static bool sameAsAnswer(const QueryResults& results, const vector<vector<int>>& answer) {
+  if (results.size() != answer.size()) return false;
+  for (size_t i = 0; i < answer.size(); ++i) {
+    Span<int> ids = results[i];
+    if (!equal(ids.begin(), ids.end(), answer[i].begin(), answer[i].end())) return false;
+  }
+  return true;
+}
+
+// Consulta o objeto de THREADS threads; as pares usam query, as ímpares uma sessão própria reaproveitada
+static bool concurrentQueries(const BSPMesh& mesh, Span<Segment> segments, const vector<vector<int>>& answer) {
+  atomic<int> mismatches{0};
+  vector<thread> pool;
+  for (int t = 0; t < THREADS; ++t) {
+    pool.emplace_back([&, t] {
+      unique_ptr<QuerySession> session = t % 2 ? mesh.session() : nullptr;
+      QueryResults results;
+      for (int round = 0; round < ROUNDS; ++round) {
+        if (session) session->run(segments, results);
+        else results = mesh.query(segments);
+        if (!sameAsAnswer(results, answer)) mismatches++;
+      }
+    });
+  }
+  for (thread& worker : pool) worker.join();
+  return mismatches == 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Uso: %s <entrada.in> <gabarito.out>\n", argv[0]);
+    return 1;
+  }
+
+  BSPData data;
+  vector<vector<int>> answer;
+  try {
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) throw runtime_error(string("não foi possível abrir ") + argv[1]);
+    data = readInput(fd);
+    close(fd);
+    answer = readAnswer(argv[2]);
+  } catch (const runtime_error& e) {
+    fprintf(stderr, "Erro: %s\n", e.what());
+    return 1;
+  }
+
+  struct Case {
+    const char* name;
+    MeshOptions options;
+  };
+  vector<Case> cases(4);
+  cases[0].name = "bsp";
+  cases[1].name = "bsp com baldes";
+  cases[1].options.build.leaf_size = 8;
+  cases[2].name = "grid";
+  cases[2].options.index = IndexKind::GRID;
+  cases[3].name = "bvh compacta";
+  cases[3].options.index = IndexKind::BVH;
+  cases[3].options.compact = true;
+
+  int failures = 0;
+  for (const Case& test : cases) {
+    // Os spans só precisam valer durante a construção: o objeto guarda a sua própria cópia
+    vector<Point3D> points = data.points;
+    vector<Triangle> triangles = data.triangles;
+    BSPMesh mesh(points, triangles, test.options);
+    points.clear();
+    triangles.clear();
+
+    bool ok = concurrentQueries(mesh, data.segments, answer);
+    BSPMesh moved = move(mesh);
+    ok = ok && sameAsAnswer(moved.query(data.segments), answer);
+    printf("%s biblioteca %s: %d threads\n", ok ? "✔" : "✘", test.name, THREADS);
+    failures += !ok;
+  }
+
+  // Coordenadas fora do intervalo são recusadas com exceção, sem encerrar o programa
+  try {
+    Point3D far(COORD_LIMIT, 0, 0);
+    Triangle tri(1, 1, 1);
+    BSPMesh mesh(Span<Point3D>(&far, 1), Span<Triangle>(&tri, 1));
+    printf("✘ biblioteca: coordenada fora do intervalo aceita\n");
+    failures++;
+  } catch (const runtime_error&) {
+    printf("✔ biblioteca: coordenada fora do intervalo recusada\n");
+  }
+  return failures > 0 ? 1 : 0;
+}